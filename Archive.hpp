@@ -0,0 +1,884 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <iomanip>
+#include <string_view>
+#include <span>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <latch>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+
+#include "ArchiveFile.hpp"
+#include "CentralDirectoryIndex.hpp"
+#include "Crc32.hpp"
+#include "IndexCache.hpp"
+#include "Inflate.hpp"
+#include "IoScheduler.hpp"
+#include "ParallelInflate.hpp"
+#include "SeekIndex.hpp"
+#include "Sink.hpp"
+#include "Stats.hpp"
+#include "ThreadPool.hpp"
+#include "ZipRecords.hpp"
+
+void printSpecialString(const std::string_view string);
+CentralDirectoryIndex readAllCentralDirsHeaders(const ArchiveFile &file);
+CentralDirectoryIndex loadCentralDirectory(const ArchiveFile &file, const std::string &path, const IndexCache &cache);
+
+struct EOCD
+{
+    // The record is 22 bytes plus a comment of at most 65535 bytes and sits at the very end,
+    // in a ZIP64 archive right after the locator. The tail is all we ever need to look at.
+    static constexpr size_t RecordSize = zip::EndOfCentralDirectoryLayout::size;
+    static constexpr size_t LocatorSize = zip::Zip64LocatorLayout::size;
+    static constexpr size_t Zip64RecordSize = zip::Zip64EndOfCentralDirectoryLayout::size;
+    static constexpr size_t SearchSize = RecordSize + 65535 + LocatorSize;
+
+    std::string_view sig, nrDisk, nrDiskWhereCDStarts, comment;
+    uint16_t comlen;
+    uint64_t nrCentralDirRecOnDisk, nrCentralDirTotal, sizeOfCD, offsetRelStart;
+    bool zip64;
+
+    friend std::ostream &operator<<(std::ostream &os, const EOCD &eocd)
+    {
+        os << "End of central directory record\n";
+        os << "Signature:                               " << eocd.sig << "\n";
+        os << "Number of this disk:                     ";
+        printSpecialString(eocd.nrDisk);
+        os << "\nDisk where CD starts:                    ";
+        printSpecialString(eocd.nrDiskWhereCDStarts);
+        os << "\nNumber of CD on disk:                    " << eocd.nrCentralDirRecOnDisk << "\n";
+        os << "Total number of CD records:              " << eocd.nrCentralDirTotal << "\n";
+        os << "Size of CD:                              " << eocd.sizeOfCD << "\n";
+        os << "Offset of start of CD relative to start: " << eocd.offsetRelStart << "\n";
+        os << "ZIP64:                                   " << (eocd.zip64 ? "yes" : "no") << "\n";
+        os << "Comment length:                          " << eocd.comlen << "\n";
+        os << "Comment:                                 " << eocd.comment << "\n";
+        return os;
+    }
+};
+
+uint16_t readLE16(const uint8_t *bytes);
+uint32_t readLE32(const uint8_t *bytes);
+uint64_t readLE64(const uint8_t *bytes);
+void applyZip64ExtraField(zip::CentralHeader &header, std::span<const uint8_t> extraField);
+std::string_view viewBytes(const uint8_t *bytes, size_t size);
+bool createLocalDescriptionTable(const ArchiveFile &file, const EntryInfo &CD, Sink &sink, std::span<const uint8_t> prefetched = {}, size_t threads = 1, bool verifyStored = false);
+uint64_t entryDataOffset(const ArchiveFile &file, const EntryInfo &entry);
+uint64_t localDataOffset(const uint8_t *bytes, const EntryInfo &entry);
+SeekIndex buildSeekIndex(const ArchiveFile &file, const EntryInfo &entry, uint64_t spacing);
+void readEntryRange(const ArchiveFile &file, const EntryInfo &entry, uint64_t offset, uint64_t length, Sink &sink, const SeekIndex *seekIndex);
+std::optional<std::filesystem::path> entryTarget(const std::filesystem::path &directory, std::string_view name);
+bool extractToDirectory(const ArchiveFile &file, const EntryInfo &entry, const std::filesystem::path &directory, std::span<const uint8_t> prefetched = {}, size_t threads = 1, bool verifyStored = false);
+void extractAllParallel(const ArchiveFile &file, const CentralDirectoryIndex &index, const std::filesystem::path &directory, size_t threads, bool verifyStored = false);
+EOCD scanForEOCD(const ArchiveFile &file, std::vector<uint8_t> &scratch);
+EOCD parseEOCD(std::span<const uint8_t> tail, uint64_t fileSize, uint64_t &eocd64Offset);
+void applyEOCD64(EOCD &eocd, const uint8_t *eocd64, uint64_t eocd64Offset);
+void checkDirectoryBounds(const EOCD &eocd, uint64_t directoryEnd);
+uint32_t eocdChecksum(const ArchiveFile &file, const EOCD &eocd);
+CentralDirectoryIndex parseCentralDirectory(const ArchiveFile &file, const EOCD &eocd);
+CentralDirectoryIndex parseCentralDirectory(std::span<const uint8_t> directory, const EOCD &eocd);
+
+inline uint16_t readLE16(const uint8_t *bytes)
+{
+    return layout::loadLE<uint16_t>(bytes);
+}
+
+inline uint32_t readLE32(const uint8_t *bytes)
+{
+    return layout::loadLE<uint32_t>(bytes);
+}
+
+inline uint64_t readLE64(const uint8_t *bytes)
+{
+    return layout::loadLE<uint64_t>(bytes);
+}
+
+// Fields that overflowed their 32-bit slot are 0xFFFFFFFF in the header and the real
+// values follow in the 0x0001 extra field, in a fixed order and only for those fields
+inline void applyZip64ExtraField(zip::CentralHeader &header, std::span<const uint8_t> extraField)
+{
+    const uint8_t *extra = extraField.data();
+    size_t remaining = extraField.size();
+
+    while (remaining >= 4)
+    {
+        const uint16_t tag = readLE16(extra);
+        const uint16_t size = readLE16(extra + 2);
+
+        if (size > remaining - 4)
+        {
+            break;
+        }
+
+        if (tag == 0x0001)
+        {
+            const uint8_t *field = extra + 4;
+            const uint8_t *fieldEnd = field + size;
+
+            for (uint64_t *value : {&header.uncompressedSize, &header.compressedSize, &header.localHeaderOffset})
+            {
+                if (*value == 0xFFFFFFFF)
+                {
+                    if (fieldEnd - field < 8)
+                    {
+                        throw std::runtime_error("Truncated ZIP64 extra field");
+                    }
+                    *value = readLE64(field);
+                    field += 8;
+                }
+            }
+
+            if (header.diskStart == 0xFFFF && fieldEnd - field >= 4)
+            {
+                header.diskStart = readLE32(field);
+            }
+            return;
+        }
+
+        extra += 4 + size;
+        remaining -= 4 + size;
+    }
+}
+
+inline std::string_view viewBytes(const uint8_t *bytes, size_t size)
+{
+    return std::string_view(reinterpret_cast<const char *>(bytes), size);
+}
+
+// prefetched, when given, holds the entry's bytes from its local header on as the I/O
+// scheduler read them. Whatever falls outside it is read from the file as usual.
+// With more than one thread a large deflated entry that is in memory is decoded in parallel.
+// Stored entries go from the archive to a sink that takes kernel copies without passing
+// through here, their CRC is then only checked with verifyStored.
+inline bool createLocalDescriptionTable(const ArchiveFile &file, const EntryInfo &CD, Sink &sink, std::span<const uint8_t> prefetched, size_t threads, bool verifyStored)
+{
+    // Whatever the inflate, CRC, output and read timers below do not claim is header work
+    ZIPREADER_TIME(LocalHeader);
+    ZIPREADER_COUNT(Entries, 1);
+
+    std::vector<uint8_t> headerScratch, nameScratch;
+
+    const auto contains = [&CD, prefetched](uint64_t offset, uint64_t length)
+    {
+        return offset - CD.localHeaderOffset <= prefetched.size() && length <= prefetched.size() - (offset - CD.localHeaderOffset);
+    };
+    const auto read = [&](uint64_t offset, size_t length, std::vector<uint8_t> &scratch)
+    {
+        return contains(offset, length) ? prefetched.subspan(offset - CD.localHeaderOffset, length) : file.read(offset, length, scratch);
+    };
+
+    zip::LocalHeader header = zip::LocalHeaderLayout::decode(read(CD.localHeaderOffset, zip::LocalHeaderLayout::size, headerScratch).data());
+
+    if (header.signature != zip::LocalHeader::Signature)
+    {
+        std::cerr << "Bad local file header signature for " << CD.name << "\n";
+        return false;
+    }
+
+    // Zero for bit 3 entries, 0xFFFFFFFF for ZIP64 ones, the central directory knows either way
+    if (header.compressedSize == 0 || header.compressedSize == 0xFFFFFFFF)
+    {
+        header.compressedSize = CD.compressedSize;
+    }
+
+    if (header.uncompressedSize == 0 || header.uncompressedSize == 0xFFFFFFFF)
+    {
+        header.uncompressedSize = CD.uncompressedSize;
+    }
+
+    const uint64_t namesOffset = CD.localHeaderOffset + zip::LocalHeaderLayout::size;
+    const std::span<const uint8_t> names = read(namesOffset, header.nameLength + header.extraLength, nameScratch);
+    const std::string_view name = viewBytes(names.data(), header.nameLength);
+    const uint64_t dataOffset = namesOffset + names.size();
+
+    const uint16_t compMethod = header.method;
+    uint32_t crc = 0;
+
+    try
+    {
+        const bool inMemory = contains(dataOffset, header.compressedSize);
+
+        ArchiveRangeSource fromFile(file, dataOffset, inMemory ? 0 : header.compressedSize);
+        SpanSource fromMemory(inMemory ? prefetched.subspan(dataOffset - CD.localHeaderOffset, header.compressedSize)
+                                       : std::span<const uint8_t>());
+        InputSource &input = inMemory ? static_cast<InputSource &>(fromMemory) : fromFile;
+
+        if (compMethod == 8 && threads > 1 && header.compressedSize >= ParallelInflater::MinimumInput && (inMemory || file.mapped()))
+        {
+            sink.begin(CD.uncompressedSize);
+
+            std::vector<uint8_t> unused;
+            const std::span<const uint8_t> data = read(dataOffset, static_cast<size_t>(header.compressedSize), unused);
+
+            ParallelInflater inflater(data, sink, threads);
+            inflater.inflate();
+            crc = inflater.crc32();
+        }
+        else if (compMethod == 8)
+        {
+            sink.begin(CD.uncompressedSize);
+
+            ZIPREADER_TIME(Inflate);
+            Inflater inflater(input, sink);
+            inflater.inflate();
+            crc = inflater.crc32();
+        }
+        else if (compMethod == 0)
+        {
+            sink.begin(CD.uncompressedSize);
+
+            // Not worth it for bytes that are in memory already, or that would have to be
+            // read in anyway to check them
+            bool copied = false;
+            if (file.mapped() || (!inMemory && !verifyStored))
+            {
+                ZIPREADER_TIME(Output);
+                copied = sink.copyFrom(file.descriptor(), dataOffset, header.compressedSize);
+            }
+
+            if (copied)
+            {
+                ZIPREADER_COUNT(BytesWritten, header.compressedSize);
+
+                if (verifyStored)
+                {
+                    ZIPREADER_TIME(Crc);
+                    std::vector<uint8_t> unused;
+                    const std::span<const uint8_t> data = read(dataOffset, static_cast<size_t>(header.compressedSize), unused);
+                    crc = Crc32::compute(0, data.data(), data.size());
+                }
+                else
+                {
+                    crc = CD.crc32;
+                }
+            }
+
+            Crc32 checksum;
+            for (std::span<const uint8_t> piece = copied ? std::span<const uint8_t>() : input.next(); !piece.empty(); piece = input.next())
+            {
+                // The mapping hands out the whole entry at once, still feed the sink bounded chunks
+                while (!piece.empty())
+                {
+                    const std::span<const uint8_t> chunk = piece.first(std::min(piece.size(), Inflater::ChunkSize));
+                    {
+                        ZIPREADER_TIME(Crc);
+                        checksum.update(chunk.data(), chunk.size());
+                    }
+                    {
+                        ZIPREADER_TIME(Output);
+                        sink.write(chunk.data(), chunk.size());
+                    }
+                    ZIPREADER_COUNT(BytesWritten, chunk.size());
+                    piece = piece.subspan(chunk.size());
+                }
+            }
+
+            if (!copied)
+            {
+                crc = checksum.value();
+            }
+        }
+        else
+        {
+            std::cerr << "Unsupported compression method " << compMethod << " for " << name << "\n";
+            return false;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error extracting " << CD.name << ": " << e.what() << "\n";
+        return false;
+    }
+
+    // The central directory copy is the one that is always filled in, even for bit 3 entries
+    if (crc != CD.crc32)
+    {
+        std::cerr << "CRC-32 mismatch for " << CD.name << "\n";
+        return false;
+    }
+
+    sink.finish();
+    return true;
+}
+
+// Where the entry's data starts, right after its local header
+inline uint64_t entryDataOffset(const ArchiveFile &file, const EntryInfo &entry)
+{
+    std::vector<uint8_t> scratch;
+    return localDataOffset(file.read(entry.localHeaderOffset, zip::LocalHeaderLayout::size, scratch).data(), entry);
+}
+
+// Same from the fixed part of the local header, already read
+inline uint64_t localDataOffset(const uint8_t *bytes, const EntryInfo &entry)
+{
+    const zip::LocalHeader header = zip::LocalHeaderLayout::decode(bytes);
+
+    if (header.signature != zip::LocalHeader::Signature)
+    {
+        throw std::runtime_error("Bad local file header signature for " + std::string(entry.name));
+    }
+
+    return entry.localHeaderOffset + zip::LocalHeaderLayout::size + header.nameLength + header.extraLength;
+}
+
+// One full decode of a deflated entry that keeps an access point every spacing bytes
+inline SeekIndex buildSeekIndex(const ArchiveFile &file, const EntryInfo &entry, uint64_t spacing)
+{
+    if (entry.method != 8)
+    {
+        throw std::runtime_error("Only deflated entries need a seek index, " + std::string(entry.name) + " is not one");
+    }
+
+    ArchiveRangeSource input(file, entryDataOffset(file, entry), entry.compressedSize);
+    CallbackSink discard([](const uint8_t *, size_t) {});
+    std::vector<flate::AccessPoint> points;
+
+    ZIPREADER_TIME(Inflate);
+    Inflater inflater(input, discard);
+    inflater.recordAccessPoints(points, spacing);
+    inflater.inflate();
+
+    if (inflater.crc32() != entry.crc32)
+    {
+        throw std::runtime_error("CRC-32 mismatch for " + std::string(entry.name));
+    }
+    return SeekIndex(entry, std::move(points));
+}
+
+// The bytes [offset, offset + length) of an entry's content, cut short at its end. Stored
+// entries are read in place. Deflated ones decode from the closest access point of
+// seekIndex before offset, or from their start without one, and stop once the range is out.
+// Nothing short of the whole entry can be checked against its CRC, so nothing is.
+inline void readEntryRange(const ArchiveFile &file, const EntryInfo &entry, uint64_t offset, uint64_t length, Sink &sink, const SeekIndex *seekIndex)
+{
+    if (seekIndex && !seekIndex->matches(entry))
+    {
+        throw std::runtime_error("Seek index does not belong to " + std::string(entry.name));
+    }
+
+    length = offset < entry.uncompressedSize ? std::min(length, entry.uncompressedSize - offset) : 0;
+    sink.begin(length);
+
+    if (length == 0)
+    {
+        sink.finish();
+        return;
+    }
+
+    const uint64_t dataOffset = entryDataOffset(file, entry);
+
+    if (entry.method == 0)
+    {
+        if (length > entry.compressedSize || offset > entry.compressedSize - length)
+        {
+            throw std::runtime_error("Stored entry " + std::string(entry.name) + " is shorter than its announced size");
+        }
+
+        ArchiveRangeSource input(file, dataOffset + offset, length);
+        for (std::span<const uint8_t> piece = input.next(); !piece.empty(); piece = input.next())
+        {
+            while (!piece.empty())
+            {
+                const std::span<const uint8_t> chunk = piece.first(std::min(piece.size(), Inflater::ChunkSize));
+                sink.write(chunk.data(), chunk.size());
+                piece = piece.subspan(chunk.size());
+            }
+        }
+    }
+    else if (entry.method == 8)
+    {
+        const flate::AccessPoint *point = seekIndex ? seekIndex->closest(offset) : nullptr;
+        const uint64_t startByte = point ? point->bit >> 3 : 0;
+        const uint64_t startOutput = point ? point->output : 0;
+
+        ArchiveRangeSource input(file, dataOffset + startByte, entry.compressedSize - startByte);
+        SliceSink slice(sink, offset - startOutput, length);
+
+        ZIPREADER_TIME(Inflate);
+        Inflater inflater(input, slice);
+        if (point)
+        {
+            inflater.resumeAt(*point);
+        }
+
+        inflater.inflateUntil(offset - startOutput + length);
+
+        if (!slice.done())
+        {
+            throw std::runtime_error("Entry " + std::string(entry.name) + " is shorter than its announced size");
+        }
+    }
+    else
+    {
+        throw std::runtime_error("Unsupported compression method " + std::to_string(entry.method) + " for " + std::string(entry.name));
+    }
+
+    sink.finish();
+}
+
+// Where an entry goes under directory, nothing if its name would escape it
+inline std::optional<std::filesystem::path> entryTarget(const std::filesystem::path &directory, std::string_view name)
+{
+    const std::filesystem::path relative = std::filesystem::path(name).lexically_normal();
+
+    // Never write outside the target directory, whatever the archive claims
+    if (relative.empty() || relative.is_absolute() || *relative.begin() == "..")
+    {
+        std::cerr << "Skipping unsafe path " << name << "\n";
+        return std::nullopt;
+    }
+
+    return directory / relative;
+}
+
+inline bool extractToDirectory(const ArchiveFile &file, const EntryInfo &entry, const std::filesystem::path &directory, std::span<const uint8_t> prefetched, size_t threads, bool verifyStored)
+{
+    const std::optional<std::filesystem::path> destination = entryTarget(directory, entry.name);
+
+    if (!destination)
+    {
+        return false;
+    }
+
+    const std::filesystem::path &target = *destination;
+
+    if (entry.name.back() == '/')
+    {
+        std::filesystem::create_directories(target);
+        return true;
+    }
+
+    std::filesystem::create_directories(target.parent_path());
+
+    const int fd = ::open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "Could not create " << target << ": " << std::strerror(errno) << "\n";
+        return false;
+    }
+
+    FdSink sink(fd);
+    const bool extracted = createLocalDescriptionTable(file, entry, sink, prefetched, threads, verifyStored);
+
+    ::close(fd);
+    return extracted;
+}
+
+inline void extractAllParallel(const ArchiveFile &file, const CentralDirectoryIndex &index, const std::filesystem::path &directory, size_t threads, bool verifyStored)
+{
+    IoScheduler scheduler(file, index);
+    std::atomic<size_t> failures{0};
+    ThreadPool pool(threads);
+
+    // Entries big enough to be decoded in parallel share the threads between them
+    const size_t huge = static_cast<size_t>(std::count_if(scheduler.largeEntries().begin(), scheduler.largeEntries().end(), [&index](uint32_t i)
+                                                          { return index.entry(i).compressedSize >= ParallelInflater::MinimumInput; }));
+    const size_t decodeThreads = std::max<size_t>(1, threads / std::max<size_t>(huge, 1));
+
+    // Big entries stream straight from the file, biggest first so stealing evens out the tail
+    for (const uint32_t i : scheduler.largeEntries())
+    {
+        pool.submit([&file, &index, &directory, &failures, decodeThreads, verifyStored, i]
+                    {
+            if (!extractToDirectory(file, index.entry(i), directory, {}, decodeThreads, verifyStored))
+            {
+                ++failures;
+            } });
+    }
+
+    // Small ones come in batches of coalesced reads. The next batch is read while the workers
+    // extract the current one, and at most those two are held in memory.
+    if (scheduler.batchCount())
+    {
+        scheduler.begin(0);
+    }
+
+    for (size_t b = 0; b < scheduler.batchCount(); ++b)
+    {
+        const std::shared_ptr<IoScheduler::Batch> batch = std::make_shared<IoScheduler::Batch>(scheduler.complete());
+        std::latch extracted(static_cast<std::ptrdiff_t>(batch->entries.size()));
+
+        if (b + 1 < scheduler.batchCount())
+        {
+            scheduler.begin(b + 1);
+        }
+
+        for (const IoScheduler::Prefetched &prefetched : batch->entries)
+        {
+            pool.submit([&file, &index, &directory, &failures, &extracted, batch, prefetched, verifyStored]
+                        {
+                try
+                {
+                    if (!extractToDirectory(file, index.entry(prefetched.entry), directory, prefetched.bytes, 1, verifyStored))
+                    {
+                        ++failures;
+                    }
+                }
+                catch (const std::exception &e)
+                {
+                    std::cerr << "Error extracting " << index.name(prefetched.entry) << ": " << e.what() << "\n";
+                    ++failures;
+                }
+                extracted.count_down(); });
+        }
+
+        extracted.wait();
+    }
+
+    pool.wait();
+
+    if (failures)
+    {
+        throw std::runtime_error(std::to_string(failures.load()) + " entries could not be extracted");
+    }
+}
+
+inline void printSpecialString(const std::string_view string)
+{
+    for (size_t i = 0; i < string.size(); ++i)
+    {
+        if (std::isprint(static_cast<unsigned char>(string[i])))
+        {
+            std::cout << string[i];
+        }
+        else
+        {
+            // If non-printable, print its hex value in escape format
+            std::cout << "\\" << std::oct << static_cast<unsigned int>(static_cast<unsigned char>(string[i])) << std::dec;
+        }
+    }
+}
+
+inline EOCD scanForEOCD(const ArchiveFile &file, std::vector<uint8_t> &scratch)
+{
+    ZIPREADER_TIME(Locate);
+
+    const size_t tailSize = static_cast<size_t>(std::min<uint64_t>(file.size(), EOCD::SearchSize));
+    const std::span<const uint8_t> tail = file.read(file.size() - tailSize, tailSize, scratch);
+
+    uint64_t eocd64Offset = 0;
+    EOCD eocd = parseEOCD(tail, file.size(), eocd64Offset);
+
+    if (eocd.zip64)
+    {
+        std::vector<uint8_t> eocd64Scratch;
+        applyEOCD64(eocd, file.read(eocd64Offset, EOCD::Zip64RecordSize, eocd64Scratch).data(), eocd64Offset);
+    }
+
+    return eocd;
+}
+
+// tail is the end of a file of fileSize bytes, EOCD::SearchSize of it or the whole file
+// when it is smaller. For a ZIP64 archive the result has zip64 set and eocd64Offset says
+// where the ZIP64 record is, it still has to be read and passed to applyEOCD64.
+inline EOCD parseEOCD(std::span<const uint8_t> tail, uint64_t fileSize, uint64_t &eocd64Offset)
+{
+    const size_t tailSize = tail.size();
+    const uint64_t tailStart = fileSize - tailSize;
+    const uint8_t *buff = tail.data();
+
+    if (tailSize < EOCD::RecordSize)
+    {
+        throw std::runtime_error("File too small, not a valid zip file");
+    }
+
+    // Scan backwards, a match only counts if its comment length lands exactly on the end
+    // of the file, which rules out signatures that happen to appear in compressed data
+    size_t found = tailSize;
+    for (size_t i = tailSize - EOCD::RecordSize + 1; i-- > 0;)
+    {
+        if (buff[i] != 0x50 || buff[i + 1] != 0x4b || buff[i + 2] != 0x05 || buff[i + 3] != 0x06)
+        {
+            continue;
+        }
+
+        if (i + EOCD::RecordSize + readLE16(buff + i + 20) == tailSize)
+        {
+            found = i;
+            break;
+        }
+    }
+
+    if (found == tailSize)
+    {
+        throw std::runtime_error("Sequence not found, not a valid zip file");
+    }
+
+    const uint8_t *record = buff + found;
+    const uint64_t recordOffset = tailStart + found;
+    const zip::EndOfCentralDirectory end = zip::EndOfCentralDirectoryLayout::decode(record);
+
+    EOCD eocd;
+    eocd.sig = "06054b50";
+    eocd.nrDisk = viewBytes(record + 4, 2);
+    eocd.nrDiskWhereCDStarts = viewBytes(record + 6, 2);
+    eocd.nrCentralDirRecOnDisk = end.entriesOnDisk;
+    eocd.nrCentralDirTotal = end.entries;
+    eocd.sizeOfCD = end.directorySize;
+    eocd.offsetRelStart = end.directoryOffset;
+    eocd.comlen = end.commentLength;
+    eocd.comment = viewBytes(record + EOCD::RecordSize, eocd.comlen);
+    eocd.zip64 = false;
+
+    // A ZIP64 archive has a 20 byte locator right before the classic record pointing at
+    // the ZIP64 end of central directory record, which holds the 64-bit values. The search
+    // size leaves room for it, a record too close to the start of the tail to have one
+    // is too close to the start of the file as well.
+    if (found >= EOCD::LocatorSize)
+    {
+        const zip::Zip64Locator locator = zip::Zip64LocatorLayout::decode(record - EOCD::LocatorSize);
+
+        if (locator.signature == zip::Zip64Locator::Signature)
+        {
+            eocd64Offset = locator.endOffset;
+
+            if (eocd64Offset > recordOffset - EOCD::LocatorSize || recordOffset - EOCD::LocatorSize - eocd64Offset < EOCD::Zip64RecordSize)
+            {
+                throw std::runtime_error("ZIP64 end of central directory locator points outside the archive");
+            }
+
+            eocd.zip64 = true;
+            return eocd;
+        }
+    }
+
+    checkDirectoryBounds(eocd, recordOffset);
+    return eocd;
+}
+
+inline void applyEOCD64(EOCD &eocd, const uint8_t *eocd64, uint64_t eocd64Offset)
+{
+    const zip::Zip64EndOfCentralDirectory end = zip::Zip64EndOfCentralDirectoryLayout::decode(eocd64);
+
+    if (end.signature != zip::Zip64EndOfCentralDirectory::Signature)
+    {
+        throw std::runtime_error("Bad ZIP64 end of central directory signature");
+    }
+
+    eocd.nrCentralDirRecOnDisk = end.entriesOnDisk;
+    eocd.nrCentralDirTotal = end.entries;
+    eocd.sizeOfCD = end.directorySize;
+    eocd.offsetRelStart = end.directoryOffset;
+
+    checkDirectoryBounds(eocd, eocd64Offset);
+}
+
+inline void checkDirectoryBounds(const EOCD &eocd, uint64_t directoryEnd)
+{
+    if (eocd.offsetRelStart > directoryEnd || eocd.sizeOfCD > directoryEnd - eocd.offsetRelStart)
+    {
+        throw std::runtime_error("Central directory overlaps the end of central directory record");
+    }
+}
+
+// Everything from the end of the central directory to the end of the file: the ZIP64
+// records if any, the EOCD record and its comment. Cheap, and it changes whenever the
+// directory moves, grows or gets rewritten.
+inline uint32_t eocdChecksum(const ArchiveFile &file, const EOCD &eocd)
+{
+    std::vector<uint8_t> scratch;
+    const uint64_t directoryEnd = eocd.offsetRelStart + eocd.sizeOfCD;
+    const std::span<const uint8_t> tail = file.read(directoryEnd, static_cast<size_t>(file.size() - directoryEnd), scratch);
+
+    return Crc32::compute(0, tail.data(), tail.size());
+}
+
+inline CentralDirectoryIndex readAllCentralDirsHeaders(const ArchiveFile &file)
+{
+    std::vector<uint8_t> tailScratch;
+    const EOCD eocd = scanForEOCD(file, tailScratch);
+
+    // std::cout << eocd;
+    // std::cout << "\n===============================================\n";
+
+    return parseCentralDirectory(file, eocd);
+}
+
+// The EOCD still gets located, it is part of the cache key, but a cache hit skips the
+// directory itself. A miss parses as usual and leaves the result for the next open.
+inline CentralDirectoryIndex loadCentralDirectory(const ArchiveFile &file, const std::string &path, const IndexCache &cache)
+{
+    std::vector<uint8_t> tailScratch;
+    const EOCD eocd = scanForEOCD(file, tailScratch);
+    const uint32_t checksum = eocdChecksum(file, eocd);
+
+    if (std::optional<CentralDirectoryIndex> cached = cache.load(path, file, checksum))
+    {
+        ZIPREADER_COUNT(IndexCacheHits, 1);
+        return std::move(*cached);
+    }
+
+    CentralDirectoryIndex index = parseCentralDirectory(file, eocd);
+    cache.store(path, file, checksum, index);
+    return index;
+}
+
+inline CentralDirectoryIndex parseCentralDirectory(const ArchiveFile &file, const EOCD &eocd)
+{
+    ZIPREADER_TIME(Directory);
+
+    std::vector<uint8_t> directoryScratch;
+
+    // The whole directory in one go, every header is a view into it
+    return parseCentralDirectory(file.read(eocd.offsetRelStart, eocd.sizeOfCD, directoryScratch), eocd);
+}
+
+inline CentralDirectoryIndex parseCentralDirectory(std::span<const uint8_t> directory, const EOCD &eocd)
+{
+    ZIPREADER_TIME(Directory);
+
+    constexpr size_t CDHeaderSize = zip::CentralHeaderLayout::size;
+
+    size_t position = 0;
+
+    CentralDirectoryIndex index;
+    // The count comes from the file, never reserve more than the directory could hold
+    index.reserve(std::min<uint64_t>(eocd.nrCentralDirTotal, eocd.sizeOfCD / CDHeaderSize), eocd.sizeOfCD);
+
+    for (uint64_t i = 0; i < eocd.nrCentralDirTotal; ++i)
+    {
+        if (directory.size() - position < CDHeaderSize)
+        {
+            throw std::runtime_error("Central directory is shorter than its entry count");
+        }
+
+        const uint8_t *buff = directory.data() + position;
+        zip::CentralHeader header = zip::CentralHeaderLayout::decode(buff);
+
+        const size_t variableSize = static_cast<size_t>(header.nameLength) + header.extraLength + header.commentLength;
+
+        if (header.signature != zip::CentralHeader::Signature || directory.size() - position - CDHeaderSize < variableSize)
+        {
+            throw std::runtime_error("Corrupt central directory header");
+        }
+
+        applyZip64ExtraField(header, directory.subspan(position + CDHeaderSize + header.nameLength, header.extraLength));
+
+        position += CDHeaderSize + variableSize;
+
+        index.add({viewBytes(buff + CDHeaderSize, header.nameLength), header.localHeaderOffset, header.compressedSize, header.uncompressedSize,
+                   header.crc32, header.flags, header.method, header.modTime, header.modDate});
+    }
+
+    index.finish();
+    return index;
+}
+
+// An opened archive. The EOCD is located and the central directory parsed once, in the
+// constructor; after that any entry can be extracted on its own by seeking straight to
+// its local header, nothing else in the archive gets touched.
+class Archive
+{
+public:
+    explicit Archive(const std::string &path, bool allowMap = true)
+        : archivePath(ArchiveFile::absolutePath(path)), archiveFile(path, allowMap), index(readAllCentralDirsHeaders(archiveFile))
+    {
+    }
+
+    // Same, but the parsed directory is looked up in and saved to the given cache
+    Archive(const std::string &path, const IndexCache &cache, bool allowMap = true)
+        : archivePath(ArchiveFile::absolutePath(path)), archiveFile(path, allowMap), index(loadCentralDirectory(archiveFile, path, cache))
+    {
+    }
+
+    size_t size() const
+    {
+        return index.size();
+    }
+
+    const CentralDirectoryIndex &entries() const
+    {
+        return index;
+    }
+
+    std::optional<EntryInfo> find(std::string_view name) const
+    {
+        const uint32_t i = index.find(name);
+
+        if (i == CentralDirectoryIndex::NotFound)
+        {
+            return std::nullopt;
+        }
+        return index.entry(i);
+    }
+
+    // Streams one entry into the sink, false if it could not be extracted or failed its CRC.
+    // More than one thread lets a large deflated entry decode on several cores. Stored entries
+    // the sink can take as kernel copies are only checked against their CRC with verifyStored.
+    bool extract(std::string_view name, Sink &sink, size_t threads = 1, bool verifyStored = false) const
+    {
+        const uint32_t i = index.find(name);
+
+        if (i == CentralDirectoryIndex::NotFound)
+        {
+            throw std::runtime_error("No entry named " + std::string(name));
+        }
+        return extract(i, sink, threads, verifyStored);
+    }
+
+    bool extract(uint32_t entry, Sink &sink, size_t threads = 1, bool verifyStored = false) const
+    {
+        return createLocalDescriptionTable(archiveFile, index.entry(entry), sink, {}, threads, verifyStored);
+    }
+
+    // Whole entry in memory, allocated once from the size the central directory announces
+    std::vector<uint8_t> extract(std::string_view name) const
+    {
+        BufferSink sink;
+
+        if (!extract(name, sink))
+        {
+            throw std::runtime_error("Could not extract " + std::string(name));
+        }
+        return sink.release();
+    }
+
+    // Decodes a deflated entry once and keeps where later reads can start from
+    SeekIndex buildSeekIndex(uint32_t entry, uint64_t spacing = SeekIndex::DefaultSpacing) const
+    {
+        return ::buildSeekIndex(archiveFile, index.entry(entry), spacing);
+    }
+
+    // Part of an entry's content, see readEntryRange. With a seek index built for the entry
+    // a read deep inside a large deflated member only decodes from the access point before it.
+    void readAt(uint32_t entry, uint64_t offset, uint64_t length, Sink &sink, const SeekIndex *seekIndex = nullptr) const
+    {
+        readEntryRange(archiveFile, index.entry(entry), offset, length, sink, seekIndex);
+    }
+
+    std::vector<uint8_t> readAt(uint32_t entry, uint64_t offset, uint64_t length, const SeekIndex *seekIndex = nullptr) const
+    {
+        BufferSink sink;
+        readAt(entry, offset, length, sink, seekIndex);
+        return sink.release();
+    }
+
+    void extractAll(const std::filesystem::path &directory, size_t threads = std::thread::hardware_concurrency(), bool verifyStored = false) const
+    {
+        extractAllParallel(archiveFile, index, directory, threads, verifyStored);
+    }
+
+    const ArchiveFile &file() const
+    {
+        return archiveFile;
+    }
+
+    // See ArchiveFile::absolutePath
+    const std::string &path() const
+    {
+        return archivePath;
+    }
+
+private:
+    std::string archivePath;
+    ArchiveFile archiveFile;
+    CentralDirectoryIndex index;
+};
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <span>
+#include <vector>
+#include <stdexcept>
+
+#ifdef ZIPREADER_STATS
+#include <atomic>
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "InputSource.hpp"
+#include "Stats.hpp"
+
+// Read-only view of an archive on disk. The whole file is mmapped when possible and
+// every read is then just a span into the mapping, nothing gets copied. Inputs that
+// cannot be mapped fall back to pread into a caller supplied scratch buffer.
+class ArchiveFile
+{
+public:
+    explicit ArchiveFile(const std::string &path, bool allowMap = true)
+    {
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0)
+        {
+            throw std::runtime_error("Could not open " + path + ": " + std::strerror(errno));
+        }
+
+        struct stat info;
+        if (::fstat(fd, &info) != 0)
+        {
+            const int error = errno;
+            ::close(fd);
+            throw std::runtime_error("Could not stat " + path + ": " + std::strerror(error));
+        }
+
+        fileSize = static_cast<uint64_t>(info.st_size);
+        modified = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+
+        if (allowMap && fileSize > 0 && S_ISREG(info.st_mode))
+        {
+            void *address = ::mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+
+            if (address != MAP_FAILED)
+            {
+                mapping = static_cast<const uint8_t *>(address);
+            }
+        }
+    }
+
+    ArchiveFile(const ArchiveFile &) = delete;
+    ArchiveFile &operator=(const ArchiveFile &) = delete;
+
+    ~ArchiveFile()
+    {
+        if (mapping)
+        {
+            ::munmap(const_cast<uint8_t *>(mapping), fileSize);
+        }
+        ::close(fd);
+    }
+
+    // Bytes [offset, offset + length) of the file. With a mapping the span points into it
+    // and scratch is left alone, otherwise scratch is resized and filled with pread.
+    std::span<const uint8_t> read(uint64_t offset, size_t length, std::vector<uint8_t> &scratch) const
+    {
+        if (offset > fileSize || length > fileSize - offset)
+        {
+            throw std::runtime_error("Read past the end of the archive");
+        }
+
+        ZIPREADER_COUNT(BytesRead, length);
+#ifdef ZIPREADER_STATS
+        // Anything that does not continue where the previous read stopped counts as a seek
+        if (lastEnd.exchange(offset + length, std::memory_order_relaxed) != offset)
+        {
+            ZIPREADER_COUNT(Seeks, 1);
+        }
+#endif
+
+        if (mapping)
+        {
+            return {mapping + offset, length};
+        }
+
+        ZIPREADER_TIME(Read);
+        scratch.resize(length);
+
+        size_t done = 0;
+        while (done < length)
+        {
+            const ssize_t got = ::pread(fd, scratch.data() + done, length - done, static_cast<off_t>(offset + done));
+            ZIPREADER_COUNT(ReadCalls, 1);
+
+            if (got < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (got <= 0)
+            {
+                throw std::runtime_error(std::string("Error reading archive: ") + (got < 0 ? std::strerror(errno) : "unexpected end of file"));
+            }
+            done += static_cast<size_t>(got);
+        }
+
+        return {scratch.data(), length};
+    }
+
+    // Tells the kernel [offset, offset + length) is about to be read so it starts paging the
+    // range in now. Only does anything for a mapping, a pread waits for its data anyway.
+    void willNeed(uint64_t offset, uint64_t length) const
+    {
+        if (!mapping || offset >= fileSize)
+        {
+            return;
+        }
+
+        const uint64_t page = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+        const uint64_t start = offset & ~(page - 1);
+        const uint64_t end = std::min(fileSize, offset + length);
+
+        ::madvise(const_cast<uint8_t *>(mapping) + start, end - start, MADV_WILLNEED);
+    }
+
+    // Absolute and normalized, the same file always gives the same string
+    static std::string absolutePath(const std::string &path)
+    {
+        return std::filesystem::absolute(path).lexically_normal().string();
+    }
+
+    uint64_t size() const { return fileSize; }
+    int64_t modifiedTime() const { return modified; }
+    int descriptor() const { return fd; }
+    bool mapped() const { return mapping != nullptr; }
+
+private:
+    int fd = -1;
+    uint64_t fileSize = 0;
+    int64_t modified = 0;
+    const uint8_t *mapping = nullptr;
+#ifdef ZIPREADER_STATS
+    mutable std::atomic<uint64_t> lastEnd{0};
+#endif
+};
+
+// Streams the byte range [offset, offset + length) of an archive. With a mapping the whole
+// range comes back as one piece, otherwise it is pread a chunk at a time into a small buffer.
+class ArchiveRangeSource : public InputSource
+{
+public:
+    static constexpr size_t ChunkSize = 65536;
+
+    ArchiveRangeSource(const ArchiveFile &archive, uint64_t offset, uint64_t length)
+        : file(archive), position(offset), remaining(length)
+    {
+    }
+
+    std::span<const uint8_t> next() override
+    {
+        if (remaining == 0)
+        {
+            return {};
+        }
+
+        const size_t length = file.mapped() ? static_cast<size_t>(remaining) : static_cast<size_t>(std::min<uint64_t>(remaining, ChunkSize));
+        const std::span<const uint8_t> piece = file.read(position, length, scratch);
+
+        position += length;
+        remaining -= length;
+        return piece;
+    }
+
+private:
+    const ArchiveFile &file;
+    uint64_t position;
+    uint64_t remaining;
+    std::vector<uint8_t> scratch;
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator. Memory is carved out of large blocks and never given back piece by
+// piece, everything goes at once when the arena is destroyed. Only meant for trivially
+// destructible data, nothing allocated here ever has a destructor run.
+class Arena
+{
+public:
+    static constexpr size_t BlockSize = 64 * 1024;
+
+    Arena() = default;
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+    Arena(Arena &&) = default;
+    Arena &operator=(Arena &&) = default;
+
+    // Makes sure the next size bytes of allocations come out of a single block
+    void reserve(size_t size)
+    {
+        if (size > capacity - used)
+        {
+            addBlock(size);
+        }
+    }
+
+    // count value initialised objects
+    template <typename T>
+    std::span<T> allocate(size_t count)
+    {
+        static_assert(std::is_trivially_destructible_v<T>, "the arena never runs destructors");
+        static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "blocks are only aligned like operator new");
+
+        if (count == 0)
+        {
+            return {};
+        }
+
+        T *objects = static_cast<T *>(allocateBytes(count * sizeof(T), alignof(T)));
+        std::uninitialized_value_construct_n(objects, count);
+        return {objects, count};
+    }
+
+    // Bytes held in blocks, handed out or not
+    size_t footprint() const
+    {
+        return total;
+    }
+
+private:
+    void *allocateBytes(size_t size, size_t alignment)
+    {
+        size_t offset = (used + alignment - 1) & ~(alignment - 1);
+
+        if (blocks.empty() || offset > capacity || size > capacity - offset)
+        {
+            addBlock(size);
+            offset = 0;
+        }
+
+        used = offset + size;
+        return blocks.back().get() + offset;
+    }
+
+    // Whatever is left of the current block is abandoned
+    void addBlock(size_t minimum)
+    {
+        const size_t size = std::max(BlockSize, minimum);
+
+        blocks.push_back(std::make_unique_for_overwrite<uint8_t[]>(size));
+        capacity = size;
+        used = 0;
+        total += size;
+    }
+
+    std::vector<std::unique_ptr<uint8_t[]>> blocks;
+    size_t capacity = 0;
+    size_t used = 0;
+    size_t total = 0;
+};
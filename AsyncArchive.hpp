@@ -0,0 +1,284 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Archive.hpp"
+#include "IoExecutor.hpp"
+#include "Task.hpp"
+
+// Archive for callers that must not block, an event loop serving many requests from one
+// thread for instance. Opening and extracting are coroutines and every read goes through
+// an IoExecutor, the coroutine is suspended until it completes, so any number of them can
+// be in flight at once on the thread polling the executor. Only opening the file itself
+// is still a plain system call.
+//
+// Both stored and deflated entries are read a chunk at a time, so a request holds about
+// a chunk of input however large the entry. The inflater pulls its input and cannot wait
+// for it: when it runs out it is stopped, the next chunk is read, and decoding resumes
+// from the last block boundary it passed (see inflateEntry).
+class AsyncArchive
+{
+public:
+    static constexpr size_t ChunkSize = 256 * 1024;
+
+    AsyncArchive(AsyncArchive &&other) noexcept
+        : executor(other.executor), fd(std::exchange(other.fd, -1)), fileSize(other.fileSize), index(std::move(other.index))
+    {
+    }
+
+    AsyncArchive(const AsyncArchive &) = delete;
+    AsyncArchive &operator=(const AsyncArchive &) = delete;
+    AsyncArchive &operator=(AsyncArchive &&) = delete;
+
+    ~AsyncArchive()
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+    }
+
+    // Locates the EOCD and reads the central directory, same as Archive's constructor
+    static async::Task<AsyncArchive> open(async::IoExecutor &executor, std::string path)
+    {
+        const int descriptor = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (descriptor < 0)
+        {
+            throw std::runtime_error("Could not open " + path + ": " + std::strerror(errno));
+        }
+
+        // Owns the descriptor from here on, whatever gets thrown below
+        AsyncArchive archive(executor, descriptor);
+
+        struct stat info;
+        if (::fstat(descriptor, &info) != 0)
+        {
+            throw std::runtime_error("Could not stat " + path + ": " + std::strerror(errno));
+        }
+        archive.fileSize = static_cast<uint64_t>(info.st_size);
+
+        std::vector<uint8_t> tail(static_cast<size_t>(std::min<uint64_t>(archive.fileSize, EOCD::SearchSize)));
+        co_await async::readExactly(executor, descriptor, archive.fileSize - tail.size(), tail);
+
+        uint64_t eocd64Offset = 0;
+        EOCD eocd = parseEOCD(tail, archive.fileSize, eocd64Offset);
+
+        if (eocd.zip64)
+        {
+            std::vector<uint8_t> eocd64(EOCD::Zip64RecordSize);
+            co_await async::readExactly(executor, descriptor, eocd64Offset, eocd64);
+            applyEOCD64(eocd, eocd64.data(), eocd64Offset);
+        }
+
+        std::vector<uint8_t> directory(static_cast<size_t>(eocd.sizeOfCD));
+        co_await async::readExactly(executor, descriptor, eocd.offsetRelStart, directory);
+
+        archive.index = parseCentralDirectory(directory, eocd);
+        co_return std::move(archive);
+    }
+
+    size_t size() const
+    {
+        return index.size();
+    }
+
+    const CentralDirectoryIndex &entries() const
+    {
+        return index;
+    }
+
+    // Streams one entry into the sink. Like Archive::extract the result is false when it
+    // could not be extracted or failed its CRC, and an unknown name throws right away.
+    // The archive and the sink have to outlive the task.
+    async::Task<bool> readEntry(std::string_view name, Sink &sink) const
+    {
+        const uint32_t i = index.find(name);
+
+        if (i == CentralDirectoryIndex::NotFound)
+        {
+            throw std::runtime_error("No entry named " + std::string(name));
+        }
+        return readEntry(i, sink);
+    }
+
+    async::Task<bool> readEntry(uint32_t entry, Sink &sink) const
+    {
+        const EntryInfo info = index.entry(entry);
+        uint32_t crc = 0;
+
+        try
+        {
+            std::vector<uint8_t> header(zip::LocalHeaderLayout::size);
+            co_await async::readExactly(*executor, fd, info.localHeaderOffset, header);
+
+            uint64_t offset = localDataOffset(header.data(), info);
+
+            if (info.method == 8)
+            {
+                sink.begin(info.uncompressedSize);
+                crc = co_await inflateEntry(offset, info.compressedSize, sink);
+            }
+            else if (info.method == 0)
+            {
+                sink.begin(info.uncompressedSize);
+
+                Crc32 checksum;
+                std::vector<uint8_t> chunk(static_cast<size_t>(std::min<uint64_t>(info.compressedSize, ChunkSize)));
+
+                for (uint64_t remaining = info.compressedSize; remaining;)
+                {
+                    const std::span<uint8_t> piece = std::span<uint8_t>(chunk).first(static_cast<size_t>(std::min<uint64_t>(remaining, chunk.size())));
+                    co_await async::readExactly(*executor, fd, offset, piece);
+
+                    checksum.update(piece.data(), piece.size());
+                    sink.write(piece.data(), piece.size());
+                    ZIPREADER_COUNT(BytesWritten, piece.size());
+
+                    offset += piece.size();
+                    remaining -= piece.size();
+                }
+                crc = checksum.value();
+            }
+            else
+            {
+                std::cerr << "Unsupported compression method " << info.method << " for " << info.name << "\n";
+                co_return false;
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error extracting " << info.name << ": " << e.what() << "\n";
+            co_return false;
+        }
+
+        if (crc != info.crc32)
+        {
+            std::cerr << "CRC-32 mismatch for " << info.name << "\n";
+            co_return false;
+        }
+
+        sink.finish();
+        co_return true;
+    }
+
+private:
+    // Thrown by ChunkSource when the inflater wants input that was not read yet
+    struct NeedInput
+    {
+    };
+
+    // The input read so far, in one piece, then either the end of the stream or NeedInput
+    class ChunkSource : public InputSource
+    {
+    public:
+        ChunkSource(std::span<const uint8_t> input, bool last)
+            : piece(input), final(last)
+        {
+        }
+
+        std::span<const uint8_t> next() override
+        {
+            if (!piece.empty())
+            {
+                return std::exchange(piece, {});
+            }
+            if (!final)
+            {
+                throw NeedInput{};
+            }
+            return {};
+        }
+
+    private:
+        std::span<const uint8_t> piece;
+        bool final;
+    };
+
+    // Decodes length bytes of deflate data from offset into the sink and returns the CRC-32
+    // of the output. Input is read a chunk at a time and only kept from the start of the
+    // block being decoded on. Each pass records an access point at every block boundary, so
+    // when a pass runs out of input the next one resumes from the last of them the sink got
+    // all output before, with what it got after skipped, instead of starting over.
+    async::Task<uint32_t> inflateEntry(uint64_t offset, uint64_t length, Sink &sink) const
+    {
+        std::vector<uint8_t> input;
+        uint64_t inputStart = 0;
+        uint64_t fetched = 0;
+        uint64_t emitted = 0;
+        flate::AccessPoint resume;
+        Crc32 checksum;
+
+        CallbackSink counted([&sink, &checksum, &emitted](const uint8_t *data, size_t size)
+                             {
+            checksum.update(data, size);
+            sink.write(data, size);
+            emitted += size; });
+
+        while (true)
+        {
+            const size_t held = input.size();
+            input.resize(held + static_cast<size_t>(std::min<uint64_t>(length - fetched, ChunkSize)));
+            co_await async::readExactly(*executor, fd, offset + fetched, std::span<uint8_t>(input).subspan(held));
+            fetched += input.size() - held;
+
+            std::vector<flate::AccessPoint> points;
+            try
+            {
+                ZIPREADER_TIME(Inflate);
+                ChunkSource source(input, fetched == length);
+                SliceSink resumed(counted, emitted - resume.output, UINT64_MAX);
+
+                Inflater inflater(source, resumed);
+                inflater.resumeAt(resume);
+                inflater.recordAccessPoints(points, 1);
+                inflater.inflate();
+                co_return checksum.value();
+            }
+            catch (const NeedInput &)
+            {
+            }
+
+            // Points are relative to where this pass started. Output the inflater had not
+            // flushed yet never reached the sink, so only a point before that will do.
+            const auto usable = std::find_if(points.rbegin(), points.rend(), [&resume, emitted](const flate::AccessPoint &point)
+                                             { return resume.output + point.output <= emitted; });
+
+            if (usable != points.rend())
+            {
+                flate::AccessPoint &last = *usable;
+                const uint64_t bit = inputStart * 8 + last.bit;
+
+                input.erase(input.begin(), input.begin() + static_cast<std::ptrdiff_t>(bit / 8 - inputStart));
+                inputStart = bit / 8;
+                resume = {resume.output + last.output, bit, std::move(last.window)};
+            }
+        }
+    }
+
+    AsyncArchive(async::IoExecutor &ioExecutor, int descriptor)
+        : executor(&ioExecutor), fd(descriptor)
+    {
+    }
+
+    async::IoExecutor *executor;
+    int fd = -1;
+    uint64_t fileSize = 0;
+    CentralDirectoryIndex index;
+};
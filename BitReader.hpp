@@ -0,0 +1,215 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <bit>
+#include <span>
+#include <stdexcept>
+
+#include "InputSource.hpp"
+
+// LSB-first bit reader over an in-memory buffer, the order DEFLATE packs its bits in.
+// Bits live in a 64-bit accumulator that is refilled a whole word at a time, after
+// a refill at least 56 bits can be peeked without touching memory again. Given an
+// InputSource it moves on to the next piece of input whenever the current one runs out.
+class BitReader
+{
+public:
+    static constexpr unsigned MaxPeekBits = 56;
+
+    BitReader() = default;
+
+    BitReader(const uint8_t *data, size_t size)
+        : begin(data), current(data), end(data + size)
+    {
+    }
+
+    explicit BitReader(InputSource &input)
+        : source(&input)
+    {
+    }
+
+    void refill()
+    {
+        if (hasFastInput())
+        {
+            refillFast();
+            return;
+        }
+
+        // Last few bytes, past the end we pad with zeros and remember how many
+        while (bitCount <= 56)
+        {
+            if (current < end)
+            {
+                bitBuffer |= static_cast<uint64_t>(*current++) << bitCount;
+            }
+            else if (nextPiece())
+            {
+                continue;
+            }
+            else
+            {
+                if (paddedBits >= MaxPaddedBits)
+                {
+                    throw std::runtime_error("Unexpected end of deflate stream");
+                }
+                paddedBits += 8;
+            }
+            bitCount += 8;
+        }
+    }
+
+    // Enough input left for refillFast(), decoders check this once per symbol
+    bool hasFastInput() const
+    {
+        return end - current >= 8;
+    }
+
+    // One unaligned load, no branches, at least 56 bits buffered afterwards.
+    // Only valid while hasFastInput() holds.
+    void refillFast()
+    {
+        bitBuffer |= loadWord(current) << bitCount;
+        current += (63 - bitCount) >> 3;
+        bitCount |= 56;
+    }
+
+    // The buffered bits as they are, whoever calls this knows enough of them are valid
+    uint64_t peekFast() const
+    {
+        return bitBuffer;
+    }
+
+    uint64_t peekBits(unsigned bits)
+    {
+        if (bitCount < bits)
+        {
+            refill();
+        }
+        return bitBuffer & ((uint64_t(1) << bits) - 1);
+    }
+
+    void consumeBits(unsigned bits)
+    {
+        bitBuffer >>= bits;
+        bitCount -= bits;
+    }
+
+    uint64_t readBits(unsigned bits)
+    {
+        const uint64_t value = peekBits(bits);
+        consumeBits(bits);
+
+        return value;
+    }
+
+    bool readBit()
+    {
+        return readBits(1);
+    }
+
+    void alignToByte()
+    {
+        consumeBits(bitCount & 7);
+    }
+
+    // Copies whole bytes straight out of the input, the reader must be byte aligned
+    void readBytes(uint8_t *out, size_t count)
+    {
+        while (count && bitCount >= 8)
+        {
+            *out++ = static_cast<uint8_t>(bitBuffer);
+            consumeBits(8);
+            --count;
+        }
+
+        if (count == 0)
+        {
+            return;
+        }
+
+        // Refills leave copies of not yet consumed bytes above bitCount, those are
+        // about to be read straight from memory so they have to go
+        bitBuffer = 0;
+
+        if (overrun())
+        {
+            throw std::runtime_error("Unexpected end of deflate stream");
+        }
+
+        while (count)
+        {
+            if (current == end && !nextPiece())
+            {
+                throw std::runtime_error("Unexpected end of deflate stream");
+            }
+
+            const size_t available = std::min(count, static_cast<size_t>(end - current));
+            std::memcpy(out, current, available);
+            current += available;
+            out += available;
+            count -= available;
+        }
+    }
+
+    // True once more bits were consumed than the input holds
+    bool overrun() const
+    {
+        return paddedBits > bitCount;
+    }
+
+    // Number of bits consumed so far
+    uint64_t bitPosition() const
+    {
+        return (consumedBefore + static_cast<uint64_t>(current - begin)) * 8 + paddedBits - bitCount;
+    }
+
+    // Number of whole bytes consumed so far, the reader should be byte aligned
+    size_t bytePosition() const
+    {
+        return static_cast<size_t>(bitPosition() >> 3);
+    }
+
+private:
+    static constexpr unsigned MaxPaddedBits = 256;
+
+    static uint64_t loadWord(const uint8_t *p)
+    {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+
+        if constexpr (std::endian::native == std::endian::big)
+        {
+            word = __builtin_bswap64(word);
+        }
+        return word;
+    }
+
+    bool nextPiece()
+    {
+        if (source == nullptr)
+        {
+            return false;
+        }
+
+        consumedBefore += static_cast<uint64_t>(end - begin);
+
+        const std::span<const uint8_t> piece = source->next();
+        begin = current = piece.data();
+        end = begin + piece.size();
+
+        return !piece.empty();
+    }
+
+    InputSource *source = nullptr;
+    uint64_t consumedBefore = 0;
+    const uint8_t *begin = nullptr;
+    const uint8_t *current = nullptr;
+    const uint8_t *end = nullptr;
+    uint64_t bitBuffer = 0;
+    unsigned bitCount = 0;
+    unsigned paddedBits = 0;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// LSB-first bit writer, the counterpart of BitReader. Bits collect in a 64-bit
+// accumulator and leave it 32 at a time, so a single putBits() costs a shift and an or.
+class BitWriter
+{
+public:
+    // value must fit in bits, at most 32 of them
+    void putBits(uint64_t value, unsigned bits)
+    {
+        bitBuffer |= value << bitCount;
+        bitCount += bits;
+
+        if (bitCount >= 32)
+        {
+            const uint32_t word = static_cast<uint32_t>(bitBuffer);
+            out.push_back(static_cast<uint8_t>(word));
+            out.push_back(static_cast<uint8_t>(word >> 8));
+            out.push_back(static_cast<uint8_t>(word >> 16));
+            out.push_back(static_cast<uint8_t>(word >> 24));
+            bitBuffer >>= 32;
+            bitCount -= 32;
+        }
+    }
+
+    // Pads with zero bits up to the next byte boundary and moves those bytes out
+    void alignToByte()
+    {
+        bitCount = (bitCount + 7) & ~7u;
+
+        while (bitCount)
+        {
+            out.push_back(static_cast<uint8_t>(bitBuffer));
+            bitBuffer >>= 8;
+            bitCount -= 8;
+        }
+    }
+
+    // Raw bytes, the writer must be byte aligned
+    void putBytes(const uint8_t *data, size_t size)
+    {
+        alignToByte();
+        out.insert(out.end(), data, data + size);
+    }
+
+    std::vector<uint8_t> release()
+    {
+        alignToByte();
+        return std::move(out);
+    }
+
+private:
+    std::vector<uint8_t> out;
+    uint64_t bitBuffer = 0;
+    unsigned bitCount = 0;
+};
@@ -0,0 +1,334 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "Arena.hpp"
+
+// What callers get back for one entry, assembled on demand from the index columns
+struct EntryInfo
+{
+    std::string_view name;
+    uint64_t localHeaderOffset, compressedSize, uncompressedSize;
+    uint32_t crc32;
+    uint16_t flags, method, modTime, modDate;
+};
+
+// Parsed central directory kept for the lifetime of an archive. Every numeric field
+// lives in its own packed column, names are slices of one blob and an open addressing
+// hash table maps a path to its entry number. All of it sits in the index's own arena,
+// so a directory of any size costs a handful of allocations and is freed in one go.
+class CentralDirectoryIndex
+{
+public:
+    static constexpr uint32_t NotFound = UINT32_MAX;
+
+    CentralDirectoryIndex() = default;
+    // The columns point into the arena, a copy would share it
+    CentralDirectoryIndex(const CentralDirectoryIndex &) = delete;
+    CentralDirectoryIndex &operator=(const CentralDirectoryIndex &) = delete;
+    CentralDirectoryIndex(CentralDirectoryIndex &&) = default;
+    CentralDirectoryIndex &operator=(CentralDirectoryIndex &&) = default;
+
+    // With the right numbers every column and the names come out of one block
+    void reserve(size_t entries, size_t nameBytes)
+    {
+        arena.reserve(entries * BytesPerEntry + nameBytes + alignof(uint32_t) + bucketCount(entries) * sizeof(uint32_t));
+        growColumns(entries);
+        growNames(nameBytes);
+    }
+
+    uint32_t add(const EntryInfo &entry)
+    {
+        if (count == localHeaderOffsets.size())
+        {
+            growColumns(std::max<size_t>(16, count * 2));
+        }
+        if (entry.name.size() > names.size() - nameBytesUsed)
+        {
+            growNames(std::max(names.size() * 2, nameBytesUsed + entry.name.size()));
+        }
+
+        const uint32_t index = static_cast<uint32_t>(count++);
+
+        localHeaderOffsets[index] = entry.localHeaderOffset;
+        compressedSizes[index] = entry.compressedSize;
+        uncompressedSizes[index] = entry.uncompressedSize;
+        crcs[index] = entry.crc32;
+        nameOffsets[index] = static_cast<uint32_t>(nameBytesUsed);
+        nameLengths[index] = static_cast<uint16_t>(entry.name.size());
+        flagBits[index] = entry.flags;
+        methods[index] = entry.method;
+        modTimes[index] = entry.modTime;
+        modDates[index] = entry.modDate;
+
+        std::copy(entry.name.begin(), entry.name.end(), names.begin() + static_cast<std::ptrdiff_t>(nameBytesUsed));
+        nameBytesUsed += entry.name.size();
+
+        return index;
+    }
+
+    // Builds the name lookup table, call once after the last add()
+    void finish()
+    {
+        const size_t capacity = bucketCount(size());
+        buckets = arena.allocate<uint32_t>(capacity);
+        std::fill(buckets.begin(), buckets.end(), NotFound);
+
+        const size_t mask = capacity - 1;
+
+        for (uint32_t i = 0; i < size(); ++i)
+        {
+            size_t slot = hash(name(i)) & mask;
+
+            while (buckets[slot] != NotFound)
+            {
+                // Duplicate names: the later entry wins, like it would when extracting in order
+                if (name(buckets[slot]) == name(i))
+                {
+                    break;
+                }
+                slot = (slot + 1) & mask;
+            }
+            buckets[slot] = i;
+        }
+    }
+
+    uint32_t find(std::string_view path) const
+    {
+        if (buckets.empty())
+        {
+            return NotFound;
+        }
+
+        const size_t mask = buckets.size() - 1;
+        size_t slot = hash(path) & mask;
+
+        while (buckets[slot] != NotFound)
+        {
+            if (name(buckets[slot]) == path)
+            {
+                return buckets[slot];
+            }
+            slot = (slot + 1) & mask;
+        }
+
+        return NotFound;
+    }
+
+    EntryInfo entry(uint32_t i) const
+    {
+        return {name(i), localHeaderOffsets[i], compressedSizes[i], uncompressedSizes[i],
+                crcs[i], flagBits[i], methods[i], modTimes[i], modDates[i]};
+    }
+
+    std::string_view name(uint32_t i) const
+    {
+        return std::string_view(names.data() + nameOffsets[i], nameLengths[i]);
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    size_t nameBytes() const
+    {
+        return nameBytesUsed;
+    }
+
+    size_t bucketSlots() const
+    {
+        return buckets.size();
+    }
+
+    // A finished index as one flat image: the columns back to back, widest first, then the
+    // names and the buckets. Nothing in it is a pointer, so it can go to disk as it is.
+    size_t imageSize() const
+    {
+        size_t offset = 0;
+        visitColumns(*this, count, nameBytesUsed, buckets.size(), [&offset](auto &column, size_t length)
+                     { offset = alignUp(offset, alignof(decltype(*column.data()))) + length * sizeof(*column.data()); });
+        return offset;
+    }
+
+    void writeImage(uint8_t *out) const
+    {
+        size_t offset = 0;
+        visitColumns(*this, count, nameBytesUsed, buckets.size(), [&offset, out](auto &column, size_t length)
+                     {
+            offset = alignUp(offset, alignof(decltype(*column.data())));
+            std::memcpy(out + offset, column.data(), length * sizeof(*column.data()));
+            offset += length * sizeof(*column.data()); });
+    }
+
+    // Points the columns straight into an image writeImage() produced, which owner keeps
+    // alive for as long as the index lives. The image is checked enough that a damaged one
+    // is refused rather than read out of bounds; false then and the index stays empty.
+    bool adoptImage(std::span<uint8_t> image, size_t entries, size_t nameBlobBytes, size_t slots, std::shared_ptr<void> owner)
+    {
+        if (entries >= NotFound || slots != bucketCount(entries) || reinterpret_cast<uintptr_t>(image.data()) % alignof(uint64_t))
+        {
+            return false;
+        }
+
+        CentralDirectoryIndex adopted;
+        size_t offset = 0;
+        bool fits = true;
+
+        visitColumns(adopted, entries, nameBlobBytes, slots, [&](auto &column, size_t length)
+                     {
+            using T = std::remove_reference_t<decltype(*column.data())>;
+            offset = alignUp(offset, alignof(T));
+            if (offset > image.size() || length > (image.size() - offset) / sizeof(T))
+            {
+                fits = false;
+                return;
+            }
+            column = std::span<T>(static_cast<T *>(static_cast<void *>(image.data() + offset)), length);
+            offset += length * sizeof(T); });
+
+        if (!fits || offset != image.size())
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < entries; ++i)
+        {
+            if (adopted.nameOffsets[i] > nameBlobBytes || adopted.nameLengths[i] > nameBlobBytes - adopted.nameOffsets[i])
+            {
+                return false;
+            }
+        }
+        // find() probes until it meets an empty bucket, so there must be as many as finish() leaves
+        size_t used = 0;
+        for (const uint32_t bucket : adopted.buckets)
+        {
+            if (bucket != NotFound && bucket >= entries)
+            {
+                return false;
+            }
+            used += bucket != NotFound;
+        }
+        if (used > entries)
+        {
+            return false;
+        }
+
+        adopted.count = entries;
+        adopted.nameBytesUsed = nameBlobBytes;
+        adopted.backing = std::move(owner);
+        *this = std::move(adopted);
+        return true;
+    }
+
+    // Bytes the whole index holds on to
+    size_t footprint() const
+    {
+        return arena.footprint();
+    }
+
+    // FNV-1a, names are short and this keeps the index free of dependencies
+    static size_t hash(std::string_view text)
+    {
+        uint64_t value = 14695981039346656037ull;
+        for (const char c : text)
+        {
+            value ^= static_cast<unsigned char>(c);
+            value *= 1099511628211ull;
+        }
+        return static_cast<size_t>(value ^ (value >> 32));
+    }
+
+private:
+
+    // At most half full
+    static size_t bucketCount(size_t entries)
+    {
+        size_t slots = 16;
+        while (slots < entries * 2)
+        {
+            slots <<= 1;
+        }
+        return slots;
+    }
+
+    static size_t alignUp(size_t offset, size_t alignment)
+    {
+        return (offset + alignment - 1) & ~(alignment - 1);
+    }
+
+    // Every column with the number of elements it holds, in image order
+    template <typename Self, typename Visit>
+    static void visitColumns(Self &self, size_t entries, size_t nameBlobBytes, size_t slots, Visit &&visit)
+    {
+        visit(self.localHeaderOffsets, entries);
+        visit(self.compressedSizes, entries);
+        visit(self.uncompressedSizes, entries);
+        visit(self.crcs, entries);
+        visit(self.nameOffsets, entries);
+        visit(self.nameLengths, entries);
+        visit(self.flagBits, entries);
+        visit(self.methods, entries);
+        visit(self.modTimes, entries);
+        visit(self.modDates, entries);
+        visit(self.names, nameBlobBytes);
+        visit(self.buckets, slots);
+    }
+
+    static constexpr size_t BytesPerEntry = 3 * sizeof(uint64_t) + 2 * sizeof(uint32_t) + 5 * sizeof(uint16_t);
+
+    // Columns that outgrow their capacity are copied to bigger ones, the old ones stay in
+    // the arena until it goes. Widest columns first so none of them needs padding.
+    void growColumns(size_t capacity)
+    {
+        moveColumn(localHeaderOffsets, capacity);
+        moveColumn(compressedSizes, capacity);
+        moveColumn(uncompressedSizes, capacity);
+        moveColumn(crcs, capacity);
+        moveColumn(nameOffsets, capacity);
+        moveColumn(nameLengths, capacity);
+        moveColumn(flagBits, capacity);
+        moveColumn(methods, capacity);
+        moveColumn(modTimes, capacity);
+        moveColumn(modDates, capacity);
+    }
+
+    void growNames(size_t capacity)
+    {
+        moveColumn(names, capacity, nameBytesUsed);
+    }
+
+    template <typename T>
+    void moveColumn(std::span<T> &column, size_t capacity)
+    {
+        moveColumn(column, capacity, count);
+    }
+
+    template <typename T>
+    void moveColumn(std::span<T> &column, size_t capacity, size_t used)
+    {
+        const std::span<T> grown = arena.allocate<T>(capacity);
+        std::copy(column.begin(), column.begin() + static_cast<std::ptrdiff_t>(used), grown.begin());
+        column = grown;
+    }
+
+    Arena arena;
+    // Set instead of the arena when the columns live in an adopted image
+    std::shared_ptr<void> backing;
+    size_t count = 0;
+    size_t nameBytesUsed = 0;
+
+    std::span<uint64_t> localHeaderOffsets, compressedSizes, uncompressedSizes;
+    std::span<uint32_t> crcs, nameOffsets;
+    std::span<uint16_t> nameLengths, flagBits, methods, modTimes, modDates;
+    std::span<char> names;
+    std::span<uint32_t> buckets;
+};
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <array>
+#include <bit>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ZIPREADER_CRC_PCLMUL 1
+#endif
+
+namespace crc
+{
+    using Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+    constexpr Tables makeTables()
+    {
+        Tables tables{};
+
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                value = (value >> 1) ^ (0xEDB88320u & (0u - (value & 1)));
+            }
+            tables[0][i] = value;
+        }
+
+        for (size_t k = 1; k < 8; ++k)
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                tables[k][i] = (tables[k - 1][i] >> 8) ^ tables[0][tables[k - 1][i] & 0xff];
+            }
+        }
+
+        return tables;
+    }
+
+    inline constexpr Tables table = makeTables();
+}
+
+// CRC-32 as used by zip (reflected 0xEDB88320). Long buffers are folded with carry-less
+// multiplication when the CPU has PCLMULQDQ, everything else goes through slicing-by-8.
+// Values follow the zlib convention: start from 0, feed data, the result is final.
+class Crc32
+{
+public:
+    void update(const uint8_t *data, size_t size)
+    {
+        state = compute(state, data, size);
+    }
+
+    uint32_t value() const
+    {
+        return state;
+    }
+
+    static uint32_t compute(uint32_t crc, const uint8_t *data, size_t size)
+    {
+        uint32_t raw = ~crc;
+
+#ifdef ZIPREADER_CRC_PCLMUL
+        static const bool usePclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+
+        if (usePclmul && size >= 64)
+        {
+            const size_t folded = size & ~size_t(15);
+            raw = foldPclmul(data, folded, raw);
+            data += folded;
+            size -= folded;
+        }
+#endif
+
+        return ~slicingBy8(raw, data, size);
+    }
+
+    // CRC of A followed by B from the CRCs of both and the length of B, zlib's crc32_combine.
+    // Appending length2 bytes multiplies the CRC of A by x^(8 * length2) modulo the polynomial.
+    static uint32_t combine(uint32_t crc1, uint32_t crc2, uint64_t length2)
+    {
+        return multiplyModP(powerOfXModP(length2, 3), crc1) ^ crc2;
+    }
+
+private:
+    // a * b modulo the CRC polynomial, both reflected
+    static constexpr uint32_t multiplyModP(uint32_t a, uint32_t b)
+    {
+        uint32_t m = 1u << 31;
+        uint32_t p = 0;
+
+        for (;;)
+        {
+            if (a & m)
+            {
+                p ^= b;
+                if ((a & (m - 1)) == 0)
+                {
+                    break;
+                }
+            }
+            m >>= 1;
+            b = b & 1 ? (b >> 1) ^ 0xEDB88320u : b >> 1;
+        }
+
+        return p;
+    }
+
+    // x^(n * 2^k) modulo the polynomial, from a table of x^(2^i)
+    static uint32_t powerOfXModP(uint64_t n, unsigned k)
+    {
+        static constexpr std::array<uint32_t, 32> powers = []
+        {
+            std::array<uint32_t, 32> table{};
+            uint32_t p = 1u << 30;
+
+            table[0] = p;
+            for (size_t i = 1; i < table.size(); ++i)
+            {
+                p = multiplyModP(p, p);
+                table[i] = p;
+            }
+            return table;
+        }();
+
+        uint32_t p = 1u << 31;
+
+        while (n)
+        {
+            if (n & 1)
+            {
+                p = multiplyModP(powers[k & 31], p);
+            }
+            n >>= 1;
+            ++k;
+        }
+
+        return p;
+    }
+
+    static uint32_t load32(const uint8_t *p)
+    {
+        uint32_t word;
+        std::memcpy(&word, p, sizeof(word));
+
+        if constexpr (std::endian::native == std::endian::big)
+        {
+            word = __builtin_bswap32(word);
+        }
+        return word;
+    }
+
+    static uint32_t slicingBy8(uint32_t crc, const uint8_t *data, size_t size)
+    {
+        const crc::Tables &table = crc::table;
+
+        while (size >= 8)
+        {
+            const uint32_t one = load32(data) ^ crc;
+            const uint32_t two = load32(data + 4);
+
+            crc = table[7][one & 0xff] ^ table[6][(one >> 8) & 0xff] ^
+                  table[5][(one >> 16) & 0xff] ^ table[4][one >> 24] ^
+                  table[3][two & 0xff] ^ table[2][(two >> 8) & 0xff] ^
+                  table[1][(two >> 16) & 0xff] ^ table[0][two >> 24];
+
+            data += 8;
+            size -= 8;
+        }
+
+        while (size--)
+        {
+            crc = table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+        }
+
+        return crc;
+    }
+
+#ifdef ZIPREADER_CRC_PCLMUL
+    // Folding as in Intel's "Fast CRC Computation Using PCLMULQDQ", four 128-bit lanes
+    // at a time, then down to one lane and a Barrett reduction. size >= 64, multiple of 16.
+    __attribute__((target("pclmul,sse4.1"))) static uint32_t foldPclmul(const uint8_t *data, size_t size, uint32_t crc)
+    {
+        alignas(16) static const uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+        alignas(16) static const uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+        alignas(16) static const uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+        alignas(16) static const uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+        __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x00));
+        __m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x10));
+        __m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x20));
+        __m128i x4 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x30));
+
+        x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+
+        __m128i x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k1k2));
+
+        data += 64;
+        size -= 64;
+
+        while (size >= 64)
+        {
+            const __m128i x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            const __m128i x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+            const __m128i x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+            const __m128i x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+            x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+            x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x00)));
+            x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x10)));
+            x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x20)));
+            x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x30)));
+
+            data += 64;
+            size -= 64;
+        }
+
+        // Four lanes into one
+        x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k3k4));
+
+        __m128i x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+        while (size >= 16)
+        {
+            x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+
+            x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+            data += 16;
+            size -= 16;
+        }
+
+        // 128 bits down to 64
+        x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+        x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+        x1 = _mm_srli_si128(x1, 8);
+        x1 = _mm_xor_si128(x1, x2);
+
+        x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(k5k0));
+
+        x2 = _mm_srli_si128(x1, 4);
+        x1 = _mm_and_si128(x1, x3);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+
+        // Barrett reduction to 32 bits
+        x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(poly));
+
+        x2 = _mm_and_si128(x1, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+        x2 = _mm_and_si128(x2, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+
+        return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+    }
+#endif
+
+    uint32_t state = 0;
+};
@@ -0,0 +1,667 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <utility>
+#include <vector>
+
+#include "BitWriter.hpp"
+#include "Inflate.hpp"
+
+namespace flate
+{
+    // Input is compressed in pieces of this size, each one on its own and primed with the
+    // 32 KiB before it, so pieces can go to different threads and still join into one stream
+    constexpr size_t CompressChunkSize = 128 * 1024;
+
+    // Huffman code lengths for the given symbol frequencies, none longer than limit.
+    // At least two symbols always get a code, inflaters reject a code with only one.
+    inline void buildCodeLengths(const uint32_t *frequencies, size_t count, unsigned limit, uint8_t *lengths)
+    {
+        std::vector<std::pair<uint32_t, uint16_t>> leaves;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            lengths[i] = 0;
+            if (frequencies[i])
+            {
+                leaves.emplace_back(frequencies[i], static_cast<uint16_t>(i));
+            }
+        }
+
+        for (size_t i = 0; leaves.size() < 2 && i < count; ++i)
+        {
+            if (!frequencies[i])
+            {
+                leaves.emplace_back(1, static_cast<uint16_t>(i));
+            }
+        }
+
+        std::sort(leaves.begin(), leaves.end());
+        const size_t n = leaves.size();
+
+        // Two queue construction, leaves come sorted and new nodes never get lighter
+        std::vector<uint64_t> weight(2 * n - 1);
+        std::vector<uint32_t> parent(2 * n - 1);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            weight[i] = leaves[i].first;
+        }
+
+        size_t nextLeaf = 0, nextNode = n;
+        for (size_t node = n; node < 2 * n - 1; ++node)
+        {
+            size_t pick[2];
+            for (size_t &picked : pick)
+            {
+                if (nextLeaf < n && (nextNode == node || weight[nextLeaf] <= weight[nextNode]))
+                {
+                    picked = nextLeaf++;
+                }
+                else
+                {
+                    picked = nextNode++;
+                }
+            }
+
+            weight[node] = weight[pick[0]] + weight[pick[1]];
+            parent[pick[0]] = parent[pick[1]] = static_cast<uint32_t>(node);
+        }
+
+        // Parents always come after their children, one backwards pass gives every depth
+        std::vector<uint32_t> depth(2 * n - 1, 0);
+        unsigned lengthCount[64] = {};
+
+        for (size_t i = 2 * n - 1; i-- > 0;)
+        {
+            if (i != 2 * n - 2)
+            {
+                depth[i] = depth[parent[i]] + 1;
+            }
+            if (i < n)
+            {
+                ++lengthCount[std::min<uint32_t>(depth[i], 63)];
+            }
+        }
+
+        // Too deep: fold everything into limit and repair the Kraft sum, as miniz does
+        for (unsigned len = limit + 1; len < 64; ++len)
+        {
+            lengthCount[limit] += lengthCount[len];
+            lengthCount[len] = 0;
+        }
+
+        uint32_t total = 0;
+        for (unsigned len = limit; len > 0; --len)
+        {
+            total += lengthCount[len] << (limit - len);
+        }
+
+        while (total != (1u << limit))
+        {
+            --lengthCount[limit];
+            for (unsigned len = limit - 1; len > 0; --len)
+            {
+                if (lengthCount[len])
+                {
+                    --lengthCount[len];
+                    lengthCount[len + 1] += 2;
+                    break;
+                }
+            }
+            --total;
+        }
+
+        // Rarest symbols get the longest codes
+        size_t leaf = 0;
+        for (unsigned len = limit; len > 0; --len)
+        {
+            for (unsigned i = 0; i < lengthCount[len]; ++i)
+            {
+                lengths[leaves[leaf++].second] = static_cast<uint8_t>(len);
+            }
+        }
+    }
+
+    // Canonical codes for the lengths, bit reversed so they can go straight into a BitWriter
+    inline void buildCodes(const uint8_t *lengths, size_t count, uint16_t *codes)
+    {
+        uint16_t lengthCount[HuffmanTable::MaxBits + 1] = {};
+        for (size_t i = 0; i < count; ++i)
+        {
+            ++lengthCount[lengths[i]];
+        }
+        lengthCount[0] = 0;
+
+        uint16_t next[HuffmanTable::MaxBits + 1] = {};
+        uint16_t code = 0;
+        for (unsigned len = 1; len <= HuffmanTable::MaxBits; ++len)
+        {
+            code = static_cast<uint16_t>((code + lengthCount[len - 1]) << 1);
+            next[len] = code;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            const unsigned len = lengths[i];
+            if (len)
+            {
+                const uint16_t value = next[len]++;
+                uint16_t reversed = 0;
+                for (unsigned bit = 0; bit < len; ++bit)
+                {
+                    reversed = static_cast<uint16_t>(reversed << 1 | ((value >> bit) & 1));
+                }
+                codes[i] = reversed;
+            }
+        }
+    }
+
+    inline unsigned lengthCode(size_t length)
+    {
+        static constexpr std::array<uint8_t, MaxMatch + 1> codes = []
+        {
+            std::array<uint8_t, MaxMatch + 1> table{};
+            for (uint8_t code = 0; code < 29; ++code)
+            {
+                for (size_t len = LengthBase[code]; len < LengthBase[code] + (size_t(1) << LengthExtra[code]) && len <= MaxMatch; ++len)
+                {
+                    table[len] = code;
+                }
+            }
+            return table;
+        }();
+
+        return codes[length];
+    }
+
+    inline unsigned distanceCode(size_t distance)
+    {
+        if (distance <= 4)
+        {
+            return static_cast<unsigned>(distance - 1);
+        }
+
+        // Two codes per power of two, the bit below the top one picks which
+        const unsigned top = static_cast<unsigned>(std::bit_width(distance - 1)) - 1;
+        return 2 * top + static_cast<unsigned>(((distance - 1) >> (top - 1)) & 1);
+    }
+}
+
+// LZ77 with hash chains and one step of lazy matching, followed by whichever of a
+// dynamic, fixed or stored block comes out smallest. Higher levels search longer chains.
+class Deflater
+{
+public:
+    explicit Deflater(int level = 6)
+        : settings(settingsFor(level)), head(size_t(1) << HashBits), prev(flate::WindowSize)
+    {
+        symbols.reserve(MaxBlockSymbols);
+    }
+
+    // Compresses data[0, size). The `dictionary` bytes right before data are history matches
+    // may refer to but that is not emitted again. Unless last, the output ends with an empty
+    // stored block, which leaves it byte aligned and ready for the next piece to follow.
+    void compress(const uint8_t *data, size_t size, size_t dictionary, bool last, BitWriter &out)
+    {
+        dictionary = std::min(dictionary, flate::WindowSize);
+        window = data - dictionary;
+        end = dictionary + size;
+
+        if (settings.maxChain == 0)
+        {
+            writeStored(data, size, last, out);
+        }
+        else
+        {
+            std::fill(head.begin(), head.end(), -1);
+            inserted = 0;
+            insertUntil(dictionary);
+
+            compressMatches(dictionary, last, out);
+        }
+
+        if (!last)
+        {
+            out.putBits(0, 3);
+            out.alignToByte();
+            out.putBits(0xffff0000, 32);
+        }
+        else
+        {
+            out.alignToByte();
+        }
+    }
+
+private:
+    static constexpr unsigned HashBits = 15;
+    static constexpr size_t WindowMask = flate::WindowSize - 1;
+    static constexpr size_t MaxBlockSymbols = 16384;
+
+    struct Settings
+    {
+        uint16_t maxChain, niceLength;
+        bool lazy;
+    };
+
+    static Settings settingsFor(int level)
+    {
+        static constexpr Settings levels[10] = {
+            {0, 0, false}, {4, 8, false}, {8, 16, false}, {16, 32, false}, {16, 32, true},
+            {32, 64, true}, {128, 128, true}, {256, 128, true}, {1024, 258, true}, {4096, 258, true}};
+
+        return levels[std::clamp(level, 0, 9)];
+    }
+
+    uint32_t hash(size_t position) const
+    {
+        const uint8_t *p = window + position;
+        const uint32_t bytes = p[0] | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16);
+        return (bytes * 0x9E3779B1u) >> (32 - HashBits);
+    }
+
+    // Adds every position before target to the chains, those without three bytes left have no hash
+    void insertUntil(size_t target)
+    {
+        for (; inserted < target; ++inserted)
+        {
+            if (inserted + 3 <= end)
+            {
+                const uint32_t h = hash(inserted);
+                prev[inserted & WindowMask] = head[h];
+                head[h] = static_cast<int32_t>(inserted);
+            }
+        }
+    }
+
+    static size_t matchLength(const uint8_t *a, const uint8_t *b, size_t maxLength)
+    {
+        size_t length = 0;
+
+        while (length + 8 <= maxLength)
+        {
+            uint64_t x, y;
+            std::memcpy(&x, a + length, 8);
+            std::memcpy(&y, b + length, 8);
+
+            if (x != y)
+            {
+                if constexpr (std::endian::native == std::endian::little)
+                {
+                    return length + (std::countr_zero(x ^ y) >> 3);
+                }
+                else
+                {
+                    return length + (std::countl_zero(x ^ y) >> 3);
+                }
+            }
+            length += 8;
+        }
+
+        while (length < maxLength && a[length] == b[length])
+        {
+            ++length;
+        }
+        return length;
+    }
+
+    // Longest earlier match for position, 0 when there is none of at least 3 bytes.
+    // Every position before this one has to be in the chains already.
+    size_t longestMatch(size_t position, size_t &distance) const
+    {
+        const size_t maxLength = std::min(flate::MaxMatch, end - position);
+        if (maxLength < 3)
+        {
+            return 0;
+        }
+
+        const size_t limit = position > flate::WindowSize ? position - flate::WindowSize : 0;
+        const uint8_t *current = window + position;
+
+        int32_t candidate = head[hash(position)];
+        size_t best = 2;
+        unsigned chain = settings.maxChain;
+
+        while (candidate >= 0 && static_cast<size_t>(candidate) >= limit && chain--)
+        {
+            const uint8_t *match = window + candidate;
+
+            if (match[best] == current[best] && match[0] == current[0] && match[1] == current[1])
+            {
+                const size_t length = matchLength(match, current, maxLength);
+
+                if (length > best)
+                {
+                    best = length;
+                    distance = position - static_cast<size_t>(candidate);
+
+                    if (length >= settings.niceLength || length == maxLength)
+                    {
+                        break;
+                    }
+                }
+            }
+
+            candidate = prev[static_cast<size_t>(candidate) & WindowMask];
+        }
+
+        return best >= 3 ? best : 0;
+    }
+
+    void compressMatches(size_t position, bool last, BitWriter &out)
+    {
+        size_t blockStart = position;
+        symbols.clear();
+
+        while (position < end)
+        {
+            size_t distance = 0;
+            const size_t length = longestMatch(position, distance);
+
+            bool literal = length == 0;
+
+            // One step of lazy matching: a longer match right after wins over this one
+            if (!literal && settings.lazy && length < settings.niceLength && position + 1 < end)
+            {
+                insertUntil(position + 1);
+
+                size_t nextDistance = 0;
+                literal = longestMatch(position + 1, nextDistance) > length;
+            }
+
+            if (literal)
+            {
+                symbols.push_back(window[position]);
+                insertUntil(++position);
+            }
+            else
+            {
+                symbols.push_back(static_cast<uint32_t>(distance << 16 | length));
+                position += length;
+                insertUntil(position);
+            }
+
+            if (symbols.size() >= MaxBlockSymbols)
+            {
+                writeBlock(blockStart, position, false, out);
+                blockStart = position;
+                symbols.clear();
+            }
+        }
+
+        if (last || !symbols.empty())
+        {
+            writeBlock(blockStart, position, last, out);
+        }
+    }
+
+    void writeStored(const uint8_t *data, size_t size, bool final, BitWriter &out)
+    {
+        do
+        {
+            const size_t length = std::min<size_t>(size, 65535);
+            const bool finalPiece = final && length == size;
+
+            out.putBits(finalPiece, 1);
+            out.putBits(0, 2);
+            out.alignToByte();
+            out.putBits(length | ((length ^ 0xffff) << 16), 32);
+            out.putBytes(data, length);
+
+            data += length;
+            size -= length;
+        } while (size);
+    }
+
+    // The symbols collected for window[from, to) as one block, whichever kind is smallest
+    void writeBlock(size_t from, size_t to, bool final, BitWriter &out)
+    {
+        uint32_t literalFrequency[286] = {};
+        uint32_t distanceFrequency[30] = {};
+        uint64_t extraBits = 0;
+
+        literalFrequency[256] = 1;
+
+        for (const uint32_t symbol : symbols)
+        {
+            const size_t distance = symbol >> 16;
+
+            if (distance == 0)
+            {
+                ++literalFrequency[symbol];
+                continue;
+            }
+
+            const unsigned lengthSymbol = flate::lengthCode(symbol & 0xffff);
+            const unsigned distanceSymbol = flate::distanceCode(distance);
+
+            ++literalFrequency[257 + lengthSymbol];
+            ++distanceFrequency[distanceSymbol];
+            extraBits += flate::LengthExtra[lengthSymbol] + flate::DistanceExtra[distanceSymbol];
+        }
+
+        // Dynamic code lengths and their run length encoded header
+        uint8_t literalLengths[286], distanceLengths[30];
+        flate::buildCodeLengths(literalFrequency, 286, 15, literalLengths);
+        flate::buildCodeLengths(distanceFrequency, 30, 15, distanceLengths);
+
+        size_t literalCount = 286, distanceCount = 30;
+        while (literalCount > 257 && literalLengths[literalCount - 1] == 0)
+        {
+            --literalCount;
+        }
+        while (distanceCount > 1 && distanceLengths[distanceCount - 1] == 0)
+        {
+            --distanceCount;
+        }
+
+        uint8_t allLengths[286 + 30];
+        std::memcpy(allLengths, literalLengths, literalCount);
+        std::memcpy(allLengths + literalCount, distanceLengths, distanceCount);
+
+        const std::vector<std::pair<uint8_t, uint8_t>> header = encodeLengths(allLengths, literalCount + distanceCount);
+
+        uint32_t codeLengthFrequency[19] = {};
+        for (const std::pair<uint8_t, uint8_t> &item : header)
+        {
+            ++codeLengthFrequency[item.first];
+        }
+
+        uint8_t codeLengthLengths[19];
+        flate::buildCodeLengths(codeLengthFrequency, 19, 7, codeLengthLengths);
+
+        size_t codeLengthCount = 19;
+        while (codeLengthCount > 4 && codeLengthLengths[flate::CodeLengthOrder[codeLengthCount - 1]] == 0)
+        {
+            --codeLengthCount;
+        }
+
+        // Sizes of the three candidates
+        uint64_t dynamicBits = 3 + 5 + 5 + 4 + 3 * codeLengthCount + extraBits;
+        uint64_t fixedBits = 3 + extraBits;
+
+        for (size_t i = 0; i < 19; ++i)
+        {
+            dynamicBits += uint64_t(codeLengthFrequency[i]) * codeLengthLengths[i];
+        }
+        dynamicBits += 2 * codeLengthFrequency[16] + 3 * codeLengthFrequency[17] + 7 * codeLengthFrequency[18];
+
+        for (size_t i = 0; i < 286; ++i)
+        {
+            dynamicBits += uint64_t(literalFrequency[i]) * literalLengths[i];
+            fixedBits += uint64_t(literalFrequency[i]) * fixedLiteralLength(i);
+        }
+        for (size_t i = 0; i < 30; ++i)
+        {
+            dynamicBits += uint64_t(distanceFrequency[i]) * distanceLengths[i];
+            fixedBits += uint64_t(distanceFrequency[i]) * 5;
+        }
+
+        const size_t bytes = to - from;
+        const uint64_t storedBits = (bytes + 5 * (bytes / 65535 + 1)) * 8 + 7;
+
+        if (storedBits <= dynamicBits && storedBits <= fixedBits)
+        {
+            writeStored(window + from, bytes, final, out);
+            return;
+        }
+
+        out.putBits(final, 1);
+
+        if (fixedBits <= dynamicBits)
+        {
+            static const std::pair<std::array<uint16_t, 288>, std::array<uint8_t, 288>> fixed = []
+            {
+                std::pair<std::array<uint16_t, 288>, std::array<uint8_t, 288>> codes{};
+                for (size_t i = 0; i < 288; ++i)
+                {
+                    codes.second[i] = static_cast<uint8_t>(fixedLiteralLength(i));
+                }
+                flate::buildCodes(codes.second.data(), 288, codes.first.data());
+                return codes;
+            }();
+            static const std::array<uint16_t, 30> fixedDistance = []
+            {
+                std::array<uint16_t, 30> codes{};
+                uint8_t lengths[30];
+                std::memset(lengths, 5, sizeof(lengths));
+                flate::buildCodes(lengths, 30, codes.data());
+                return codes;
+            }();
+            static constexpr std::array<uint8_t, 30> fixedDistanceLengths = []
+            {
+                std::array<uint8_t, 30> lengths{};
+                lengths.fill(5);
+                return lengths;
+            }();
+
+            out.putBits(1, 2);
+            writeSymbols(fixed.first.data(), fixed.second.data(), fixedDistance.data(), fixedDistanceLengths.data(), out);
+            return;
+        }
+
+        uint16_t codeLengthCodes[19] = {}, literalCodes[286] = {}, distanceCodes[30] = {};
+        flate::buildCodes(codeLengthLengths, 19, codeLengthCodes);
+        flate::buildCodes(literalLengths, 286, literalCodes);
+        flate::buildCodes(distanceLengths, 30, distanceCodes);
+
+        out.putBits(2, 2);
+        out.putBits(literalCount - 257, 5);
+        out.putBits(distanceCount - 1, 5);
+        out.putBits(codeLengthCount - 4, 4);
+
+        for (size_t i = 0; i < codeLengthCount; ++i)
+        {
+            out.putBits(codeLengthLengths[flate::CodeLengthOrder[i]], 3);
+        }
+
+        for (const std::pair<uint8_t, uint8_t> &item : header)
+        {
+            out.putBits(codeLengthCodes[item.first], codeLengthLengths[item.first]);
+
+            if (item.first >= 16)
+            {
+                static constexpr unsigned repeatBits[3] = {2, 3, 7};
+                out.putBits(item.second, repeatBits[item.first - 16]);
+            }
+        }
+
+        writeSymbols(literalCodes, literalLengths, distanceCodes, distanceLengths, out);
+    }
+
+    static unsigned fixedLiteralLength(size_t symbol)
+    {
+        return symbol < 144 ? 8 : symbol < 256 ? 9 : symbol < 280 ? 7 : 8;
+    }
+
+    // Code lengths as code length symbols: 16 repeats the previous length 3-6 times,
+    // 17 and 18 are runs of 3-10 and 11-138 zeros. Pairs of symbol and repeat count bits.
+    static std::vector<std::pair<uint8_t, uint8_t>> encodeLengths(const uint8_t *lengths, size_t count)
+    {
+        std::vector<std::pair<uint8_t, uint8_t>> encoded;
+
+        for (size_t i = 0; i < count;)
+        {
+            const uint8_t length = lengths[i];
+            size_t run = 1;
+            while (i + run < count && lengths[i + run] == length)
+            {
+                ++run;
+            }
+            i += run;
+
+            if (length == 0)
+            {
+                while (run >= 11)
+                {
+                    const size_t step = std::min<size_t>(run, 138);
+                    encoded.emplace_back(18, static_cast<uint8_t>(step - 11));
+                    run -= step;
+                }
+                if (run >= 3)
+                {
+                    encoded.emplace_back(17, static_cast<uint8_t>(run - 3));
+                    run = 0;
+                }
+            }
+            else
+            {
+                encoded.emplace_back(length, 0);
+                --run;
+
+                while (run >= 3)
+                {
+                    const size_t step = std::min<size_t>(run, 6);
+                    encoded.emplace_back(16, static_cast<uint8_t>(step - 3));
+                    run -= step;
+                }
+            }
+
+            for (; run; --run)
+            {
+                encoded.emplace_back(length, 0);
+            }
+        }
+
+        return encoded;
+    }
+
+    void writeSymbols(const uint16_t *literalCodes, const uint8_t *literalLengths,
+                      const uint16_t *distanceCodes, const uint8_t *distanceLengths, BitWriter &out) const
+    {
+        for (const uint32_t symbol : symbols)
+        {
+            const size_t distance = symbol >> 16;
+
+            if (distance == 0)
+            {
+                out.putBits(literalCodes[symbol], literalLengths[symbol]);
+                continue;
+            }
+
+            const size_t length = symbol & 0xffff;
+            const unsigned lengthSymbol = flate::lengthCode(length);
+            const unsigned distanceSymbol = flate::distanceCode(distance);
+
+            out.putBits(literalCodes[257 + lengthSymbol], literalLengths[257 + lengthSymbol]);
+            out.putBits(length - flate::LengthBase[lengthSymbol], flate::LengthExtra[lengthSymbol]);
+            out.putBits(distanceCodes[distanceSymbol], distanceLengths[distanceSymbol]);
+            out.putBits(distance - flate::DistanceBase[distanceSymbol], flate::DistanceExtra[distanceSymbol]);
+        }
+
+        out.putBits(literalCodes[256], literalLengths[256]);
+    }
+
+    Settings settings;
+    std::vector<int32_t> head, prev;
+    std::vector<uint32_t> symbols;
+
+    const uint8_t *window = nullptr;
+    size_t end = 0;
+    size_t inserted = 0;
+};
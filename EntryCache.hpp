@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "Archive.hpp"
+#include "Stats.hpp"
+
+// Decompressed entries kept in memory between reads, for long-running services that read
+// the same few entries of the same archives over and over. An entry is keyed by the
+// archive's absolute path and its own name, and only served while the archive still has
+// the size and modification time it had when the entry was cached. A hit is a hash
+// lookup and hands out the cached buffer itself; it stays alive for whoever holds it,
+// evicted or not. The least recently used entries go first once the cached contents
+// exceed the byte budget. Safe to share between threads.
+class EntryCache
+{
+public:
+    using Buffer = std::shared_ptr<const std::vector<uint8_t>>;
+
+    explicit EntryCache(size_t budget)
+        : capacity(budget)
+    {
+    }
+
+    EntryCache(const EntryCache &) = delete;
+    EntryCache &operator=(const EntryCache &) = delete;
+
+    // The entry's content, from the cache or extracted into it. Throws like Archive::extract.
+    Buffer get(const Archive &archive, std::string_view name)
+    {
+        if (Buffer cached = lookup(keyOf(archive.path(), name), versionOf(archive)))
+        {
+            return cached;
+        }
+        return load(archive, name);
+    }
+
+    // Same without an opened archive: a hit costs a stat, only a miss opens the archive
+    // and parses its central directory
+    Buffer get(const std::string &path, std::string_view name)
+    {
+        struct stat info;
+
+        if (::stat(path.c_str(), &info) == 0)
+        {
+            const Version version{static_cast<uint64_t>(info.st_size), static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec};
+
+            if (Buffer cached = lookup(keyOf(ArchiveFile::absolutePath(path), name), version))
+            {
+                return cached;
+            }
+        }
+
+        const Archive archive(path);
+        return load(archive, name);
+    }
+
+    uint64_t hits() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return hitCount;
+    }
+
+    uint64_t misses() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return missCount;
+    }
+
+    // Bytes of content cached at the moment
+    size_t bytes() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return used;
+    }
+
+    size_t entries() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return slots.size();
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        slots.clear();
+        order.clear();
+        used = 0;
+    }
+
+private:
+    struct Version
+    {
+        uint64_t size;
+        int64_t modified;
+
+        bool operator==(const Version &) const = default;
+    };
+
+    struct Slot
+    {
+        std::string key;
+        Version version;
+        Buffer content;
+    };
+
+    // Archive paths never contain a NUL, entry names may contain anything after it
+    static std::string keyOf(const std::string &archivePath, std::string_view name)
+    {
+        std::string key;
+        key.reserve(archivePath.size() + 1 + name.size());
+        key.append(archivePath).push_back('\0');
+        key.append(name);
+        return key;
+    }
+
+    static Version versionOf(const Archive &archive)
+    {
+        return {archive.file().size(), archive.file().modifiedTime()};
+    }
+
+    // Counts a hit when there is one, misses are counted once by load()
+    Buffer lookup(const std::string &key, const Version &version)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto found = slots.find(key);
+
+        if (found == slots.end() || found->second->version != version)
+        {
+            return nullptr;
+        }
+
+        // Most recently used at the front
+        order.splice(order.begin(), order, found->second);
+        ++hitCount;
+        ZIPREADER_COUNT(EntryCacheHits, 1);
+        return found->second->content;
+    }
+
+    Buffer load(const Archive &archive, std::string_view name)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++missCount;
+        }
+        ZIPREADER_COUNT(EntryCacheMisses, 1);
+
+        // Decoded outside the lock, two threads missing on the same entry both decode it
+        Buffer content = std::make_shared<const std::vector<uint8_t>>(archive.extract(name));
+        insert(keyOf(archive.path(), name), versionOf(archive), content);
+        return content;
+    }
+
+    void insert(std::string key, const Version &version, const Buffer &content)
+    {
+        if (content->size() > capacity)
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // A stale version, or another thread that decoded the same entry first
+        if (const auto found = slots.find(key); found != slots.end())
+        {
+            remove(found->second);
+        }
+
+        order.push_front(Slot{std::move(key), version, content});
+        slots.emplace(order.front().key, order.begin());
+        used += content->size();
+
+        while (used > capacity)
+        {
+            remove(std::prev(order.end()));
+        }
+    }
+
+    void remove(std::list<Slot>::iterator slot)
+    {
+        used -= slot->content->size();
+        // The map's key points into the slot, so it goes first
+        slots.erase(slot->key);
+        order.erase(slot);
+    }
+
+    const size_t capacity;
+
+    mutable std::mutex mutex;
+    std::list<Slot> order;
+    std::unordered_map<std::string_view, std::list<Slot>::iterator> slots;
+    size_t used = 0;
+    uint64_t hitCount = 0;
+    uint64_t missCount = 0;
+};
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <stdexcept>
+
+#include "Stats.hpp"
+
+// Canonical Huffman decoder built straight from a DEFLATE code-length array.
+// The root table is indexed by the next `rootBits` bits of the stream (LSB-first),
+// codes longer than that go through one second level table, so any symbol is
+// resolved with at most two probes and usually just one.
+class HuffmanTable
+{
+public:
+    static constexpr unsigned MaxBits = 15;
+    static constexpr size_t MaxSymbols = 288;
+
+    HuffmanTable() = default;
+
+    HuffmanTable(const uint8_t *lengths, size_t count, unsigned tableBits)
+    {
+        if (!build(lengths, count, tableBits))
+        {
+            throw std::runtime_error("Invalid Huffman code lengths");
+        }
+    }
+
+    // Returns false for over-subscribed codes and for incomplete codes, with the
+    // exception DEFLATE allows: a code made of a single symbol of length 1. Bad codes are
+    // turned down before anything is allocated.
+    bool build(const uint8_t *lengths, size_t count, unsigned tableBits)
+    {
+        rootBits = tableBits;
+        ZIPREADER_COUNT(HuffmanTables, 1);
+
+        if (count > MaxSymbols)
+        {
+            return false;
+        }
+
+        uint16_t lengthCount[MaxBits + 1] = {};
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (lengths[i] > MaxBits)
+            {
+                return false;
+            }
+            ++lengthCount[lengths[i]];
+        }
+        lengthCount[0] = 0;
+
+        unsigned maxLen = 0;
+        int left = 1;
+        for (unsigned len = 1; len <= MaxBits; ++len)
+        {
+            left = (left << 1) - lengthCount[len];
+            if (left < 0)
+            {
+                return false;
+            }
+            if (lengthCount[len])
+            {
+                maxLen = len;
+            }
+        }
+
+        // No symbols at all is fine too, every lookup is invalid (a block with no distances)
+        if (maxLen != 0 && left > 0 && !(maxLen == 1 && lengthCount[1] == 1))
+        {
+            return false;
+        }
+
+        table.assign(size_t(1) << rootBits, InvalidEntry);
+
+        if (maxLen == 0)
+        {
+            return true;
+        }
+
+        // Canonical codes: symbols sorted by (length, value)
+        uint16_t offsets[MaxBits + 2] = {};
+        for (unsigned len = 1; len <= MaxBits; ++len)
+        {
+            offsets[len + 1] = offsets[len] + lengthCount[len];
+        }
+
+        uint16_t sorted[MaxSymbols];
+        const size_t symbols = offsets[MaxBits + 1];
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (lengths[i])
+            {
+                sorted[offsets[lengths[i]]++] = static_cast<uint16_t>(i);
+            }
+        }
+
+        uint32_t code = 0;
+        unsigned len = 1;
+        size_t remainingAtLen = lengthCount[1];
+        uint32_t currentPrefix = UINT32_MAX;
+        size_t subTableStart = 0;
+
+        for (size_t i = 0; i < symbols; ++i)
+        {
+            while (remainingAtLen == 0)
+            {
+                code <<= 1;
+                ++len;
+                remainingAtLen = lengthCount[len];
+            }
+
+            const uint16_t symbol = sorted[i];
+            const uint32_t reversed = reverseBits(code, len);
+
+            if (len <= rootBits)
+            {
+                const uint32_t entry = makeEntry(symbol, len);
+                for (size_t index = reversed; index < table.size(); index += size_t(1) << len)
+                {
+                    table[index] = entry;
+                }
+            }
+            else
+            {
+                const uint32_t prefix = reversed & ((1u << rootBits) - 1);
+
+                if (prefix != currentPrefix)
+                {
+                    // Long codes sharing a root prefix are contiguous in canonical order,
+                    // the last one of them is the longest and sizes the sub-table
+                    uint32_t lastCode = code;
+                    unsigned lastLen = len;
+                    unsigned subMaxLen = len;
+                    size_t lastRemaining = remainingAtLen;
+
+                    for (size_t j = i + 1; j < symbols; ++j)
+                    {
+                        ++lastCode;
+                        --lastRemaining;
+                        while (lastRemaining == 0)
+                        {
+                            lastCode <<= 1;
+                            ++lastLen;
+                            lastRemaining = lengthCount[lastLen];
+                        }
+
+                        if ((lastCode >> (lastLen - rootBits)) != (code >> (len - rootBits)))
+                        {
+                            break;
+                        }
+                        subMaxLen = lastLen;
+                    }
+
+                    const unsigned subBits = subMaxLen - rootBits;
+                    subTableStart = table.size();
+                    table.resize(table.size() + (size_t(1) << subBits), InvalidEntry);
+                    table[prefix] = (static_cast<uint32_t>(subTableStart) << 16) | (subBits << 8) | SubTableFlag | rootBits;
+                    currentPrefix = prefix;
+                }
+
+                const unsigned subBits = (table[prefix] >> 8) & 0xff;
+                const uint32_t entry = makeEntry(symbol, len);
+                for (size_t index = reversed >> rootBits; index < (size_t(1) << subBits); index += size_t(1) << (len - rootBits))
+                {
+                    table[subTableStart + index] = entry;
+                }
+            }
+
+            ++code;
+            --remainingAtLen;
+        }
+
+        return true;
+    }
+
+    // Reader needs peekBits(n) and consumeBits(n), see BitReader
+    template <typename Reader>
+    uint16_t decode(Reader &reader) const
+    {
+        uint32_t entry = table[reader.peekBits(rootBits)];
+
+        if (entry & SubTableFlag)
+        {
+            const unsigned subBits = (entry >> 8) & 0xff;
+            const uint32_t bits = reader.peekBits(rootBits + subBits);
+            entry = table[(entry >> 16) + (bits >> rootBits)];
+        }
+
+        if (entry & InvalidFlag)
+        {
+            throw std::runtime_error("Invalid Huffman code in stream");
+        }
+
+        reader.consumeBits(entry & LengthMask);
+        return static_cast<uint16_t>(entry >> 16);
+    }
+
+    // Entry for the code at the bottom of bits, which must hold MaxBits valid bits.
+    // Nothing is checked, the caller looks at InvalidFlag and consumes the length.
+    uint32_t lookup(uint64_t bits) const
+    {
+        uint32_t entry = table[bits & ((uint64_t(1) << rootBits) - 1)];
+
+        if (entry & SubTableFlag)
+        {
+            const unsigned subBits = (entry >> 8) & 0xff;
+            entry = table[(entry >> 16) + ((bits >> rootBits) & ((uint64_t(1) << subBits) - 1))];
+        }
+        return entry;
+    }
+
+    // Raw access for decoders that manage their own bit buffer
+    const uint32_t *entries() const { return table.data(); }
+    unsigned root() const { return rootBits; }
+
+    static constexpr uint32_t LengthMask = 0x0f;
+    static constexpr uint32_t SubTableFlag = 0x10;
+    static constexpr uint32_t InvalidFlag = 0x20;
+
+private:
+    static constexpr uint32_t InvalidEntry = InvalidFlag;
+
+    static uint32_t makeEntry(uint16_t symbol, unsigned len)
+    {
+        return (static_cast<uint32_t>(symbol) << 16) | len;
+    }
+
+    static uint32_t reverseBits(uint32_t code, unsigned len)
+    {
+        uint32_t result = 0;
+        for (unsigned i = 0; i < len; ++i)
+        {
+            result = (result << 1) | (code & 1);
+            code >>= 1;
+        }
+        return result;
+    }
+
+    std::vector<uint32_t> table;
+    unsigned rootBits = 0;
+};
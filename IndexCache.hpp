@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ArchiveFile.hpp"
+#include "CentralDirectoryIndex.hpp"
+#include "Crc32.hpp"
+#include "Sink.hpp"
+
+// Optional on-disk cache of parsed central directories. Every archive gets one file in
+// the cache directory, named after a hash of its absolute path: a header with the key,
+// the path itself, then the flat image of its CentralDirectoryIndex. Loading maps the
+// file and points the index columns into the mapping, nothing gets parsed. An entry only
+// counts when path, size, modification time and the EOCD checksum all still match, and
+// the image itself still has the CRC-32 it was written with.
+class IndexCache
+{
+public:
+    explicit IndexCache(std::filesystem::path directory)
+        : cacheDirectory(std::move(directory))
+    {
+    }
+
+    std::optional<CentralDirectoryIndex> load(const std::string &archivePath, const ArchiveFile &archive, uint32_t eocdChecksum) const
+    {
+        const std::string key = keyOf(archivePath);
+        const int fd = ::open(entryPath(key).c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0)
+        {
+            return std::nullopt;
+        }
+
+        struct stat info;
+        void *address = MAP_FAILED;
+        size_t size = 0;
+
+        if (::fstat(fd, &info) == 0 && static_cast<uint64_t>(info.st_size) >= sizeof(Header))
+        {
+            size = static_cast<size_t>(info.st_size);
+            // Private and writable only because the index columns are mutable spans, nothing writes to them
+            address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+
+        if (address == MAP_FAILED)
+        {
+            return std::nullopt;
+        }
+
+        const std::shared_ptr<void> mapping(address, [size](void *pointer)
+                                            { ::munmap(pointer, size); });
+        uint8_t *bytes = static_cast<uint8_t *>(address);
+
+        Header header;
+        std::memcpy(&header, bytes, sizeof(header));
+
+        const size_t imageOffset = sizeof(Header) + padded(header.pathLength);
+
+        if (std::memcmp(header.magic, Magic, sizeof(header.magic)) != 0 || header.byteOrder != ByteOrder ||
+            header.archiveSize != archive.size() || header.archiveModified != archive.modifiedTime() ||
+            header.eocdChecksum != eocdChecksum || header.pathLength != key.size() || imageOffset > size ||
+            std::memcmp(bytes + sizeof(Header), key.data(), key.size()) != 0 ||
+            Crc32::compute(0, bytes + imageOffset, size - imageOffset) != header.imageChecksum)
+        {
+            return std::nullopt;
+        }
+
+        CentralDirectoryIndex index;
+        if (!index.adoptImage({bytes + imageOffset, size - imageOffset}, header.entryCount, header.nameBytes, header.bucketSlots, mapping))
+        {
+            return std::nullopt;
+        }
+        return index;
+    }
+
+    // Best effort: a cache that cannot be written is simply not used next time either.
+    // The file is written aside and renamed into place, readers never see half of it.
+    void store(const std::string &archivePath, const ArchiveFile &archive, uint32_t eocdChecksum, const CentralDirectoryIndex &index) const
+    {
+        const std::string key = keyOf(archivePath);
+
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, Magic, sizeof(header.magic));
+        header.byteOrder = ByteOrder;
+        header.eocdChecksum = eocdChecksum;
+        header.pathLength = static_cast<uint32_t>(key.size());
+        header.archiveSize = archive.size();
+        header.archiveModified = archive.modifiedTime();
+        header.entryCount = index.size();
+        header.nameBytes = index.nameBytes();
+        header.bucketSlots = index.bucketSlots();
+
+        std::vector<uint8_t> contents(sizeof(Header) + padded(key.size()) + index.imageSize());
+        std::memcpy(contents.data() + sizeof(Header), key.data(), key.size());
+        index.writeImage(contents.data() + sizeof(Header) + padded(key.size()));
+
+        header.imageChecksum = Crc32::compute(0, contents.data() + sizeof(Header) + padded(key.size()), index.imageSize());
+        std::memcpy(contents.data(), &header, sizeof(header));
+
+        std::error_code error;
+        std::filesystem::create_directories(cacheDirectory, error);
+
+        const std::filesystem::path target = entryPath(key);
+        const std::filesystem::path temporary = target.string() + ".tmp" + std::to_string(::getpid());
+
+        const int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            return;
+        }
+
+        bool written = true;
+        try
+        {
+            FdSink sink(fd);
+            sink.write(contents.data(), contents.size());
+        }
+        catch (const std::exception &)
+        {
+            written = false;
+        }
+
+        if (::close(fd) != 0 || !written || ::rename(temporary.c_str(), target.c_str()) != 0)
+        {
+            ::unlink(temporary.c_str());
+        }
+    }
+
+    const std::filesystem::path &directory() const
+    {
+        return cacheDirectory;
+    }
+
+private:
+    static constexpr char Magic[8] = {'Z', 'R', 'I', 'N', 'D', 'E', 'X', '2'};
+    static constexpr uint32_t ByteOrder = 0x01020304;
+
+    // Multiple of 8 in size, so the path and the image after it stay aligned
+    struct Header
+    {
+        char magic[8];
+        uint32_t byteOrder;
+        uint32_t eocdChecksum;
+        uint32_t pathLength;
+        uint32_t imageChecksum;
+        uint64_t archiveSize;
+        int64_t archiveModified;
+        uint64_t entryCount;
+        uint64_t nameBytes;
+        uint64_t bucketSlots;
+    };
+
+    static size_t padded(size_t size)
+    {
+        return (size + 7) & ~size_t(7);
+    }
+
+    static std::string keyOf(const std::string &archivePath)
+    {
+        return ArchiveFile::absolutePath(archivePath);
+    }
+
+    std::filesystem::path entryPath(const std::string &key) const
+    {
+        // Collisions are caught by the path stored in the header
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.idx", static_cast<unsigned long long>(CentralDirectoryIndex::hash(key)));
+        return cacheDirectory / name;
+    }
+
+    std::filesystem::path cacheDirectory;
+};
@@ -0,0 +1,528 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+
+#include "BitReader.hpp"
+#include "Crc32.hpp"
+#include "Huffman.hpp"
+#include "Sink.hpp"
+#include "Stats.hpp"
+
+namespace flate
+{
+    constexpr uint16_t LengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                         35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    constexpr uint8_t LengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                         3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    constexpr uint16_t DistanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                           193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+                                           6145, 8193, 12289, 16385, 24577};
+    constexpr uint8_t DistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                           6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    constexpr uint8_t CodeLengthOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    constexpr unsigned LiteralRootBits = 10;
+    constexpr unsigned DistanceRootBits = 8;
+    constexpr unsigned CodeLengthRootBits = 7;
+
+    constexpr size_t WindowSize = 32768;
+    constexpr size_t MaxMatch = 258;
+
+    // A place decoding can start over from, in the style of zlib's zran: the first bit of
+    // a block, the output produced before it and the last 32 KiB of that output, which is
+    // all its matches can reach back into
+    struct AccessPoint
+    {
+        uint64_t output = 0;
+        uint64_t bit = 0;
+        std::vector<uint8_t> window;
+    };
+
+    inline const HuffmanTable &fixedLiteralCodes()
+    {
+        static const HuffmanTable table = []
+        {
+            uint8_t lengths[288];
+            std::memset(lengths, 8, 144);
+            std::memset(lengths + 144, 9, 112);
+            std::memset(lengths + 256, 7, 24);
+            std::memset(lengths + 280, 8, 8);
+            return HuffmanTable(lengths, 288, LiteralRootBits);
+        }();
+        return table;
+    }
+
+    inline const HuffmanTable &fixedDistanceCodes()
+    {
+        static const HuffmanTable table = []
+        {
+            uint8_t lengths[32];
+            std::memset(lengths, 5, 32);
+            return HuffmanTable(lengths, 32, DistanceRootBits);
+        }();
+        return table;
+    }
+
+    // Reads the HLIT/HDIST/HCLEN header of a dynamic block and builds both tables.
+    // Returns false on anything RFC 1951 does not allow instead of throwing, so it
+    // can also be used to probe whether some bit offset looks like a block header.
+    inline bool readDynamicTables(BitReader &reader, HuffmanTable &literalCodes, HuffmanTable &distanceCodes)
+    {
+        const size_t HLIT = reader.readBits(5) + 257;
+        const size_t HDIST = reader.readBits(5) + 1;
+        const size_t HCLEN = reader.readBits(4) + 4;
+
+        if (HLIT > 286 || HDIST > 30)
+        {
+            return false;
+        }
+
+        uint8_t codeLengthLengths[19] = {};
+        for (size_t i = 0; i < HCLEN; ++i)
+        {
+            codeLengthLengths[CodeLengthOrder[i]] = static_cast<uint8_t>(reader.readBits(3));
+        }
+
+        HuffmanTable codeLengthCodes;
+        if (!codeLengthCodes.build(codeLengthLengths, 19, CodeLengthRootBits))
+        {
+            return false;
+        }
+
+        // Literal/length and distance lengths come as one run-length coded sequence
+        uint8_t lengths[286 + 30];
+        size_t count = 0;
+
+        while (count < HLIT + HDIST)
+        {
+            const uint32_t entry = codeLengthCodes.entries()[reader.peekBits(CodeLengthRootBits)];
+            if (entry & HuffmanTable::InvalidFlag)
+            {
+                return false;
+            }
+            reader.consumeBits(entry & HuffmanTable::LengthMask);
+
+            const uint16_t symbol = static_cast<uint16_t>(entry >> 16);
+
+            if (symbol < 16)
+            {
+                lengths[count++] = static_cast<uint8_t>(symbol);
+                continue;
+            }
+
+            uint8_t repeated = 0;
+            size_t repeat = 0;
+
+            if (symbol == 16)
+            {
+                if (count == 0)
+                {
+                    return false;
+                }
+                repeated = lengths[count - 1];
+                repeat = 3 + reader.readBits(2);
+            }
+            else if (symbol == 17)
+            {
+                repeat = 3 + reader.readBits(3);
+            }
+            else
+            {
+                repeat = 11 + reader.readBits(7);
+            }
+
+            if (count + repeat > HLIT + HDIST)
+            {
+                return false;
+            }
+            std::memset(lengths + count, repeated, repeat);
+            count += repeat;
+        }
+
+        // A block without an end-of-block code could never finish
+        if (lengths[256] == 0)
+        {
+            return false;
+        }
+
+        return literalCodes.build(lengths, HLIT, LiteralRootBits) &&
+               distanceCodes.build(lengths + HLIT, HDIST, DistanceRootBits);
+    }
+}
+
+// RFC 1951 inflater. Output goes through a sliding buffer holding the 32 KiB window
+// plus one chunk, every time the chunk fills up it is handed to the sink,
+// so memory use does not depend on how large the decompressed data is. The CRC-32 of
+// the output is computed on each chunk right before it leaves, while it is still in cache.
+class Inflater
+{
+public:
+    static constexpr size_t ChunkSize = 65536;
+    static constexpr size_t CopyOvershoot = 16;
+    static constexpr size_t FastOutputMargin = flate::MaxMatch + CopyOvershoot;
+
+    Inflater(const uint8_t *data, size_t size, Sink &sink)
+        : reader(data, size), output(sink), buffer(flate::WindowSize + ChunkSize)
+    {
+    }
+
+    Inflater(InputSource &input, Sink &sink)
+        : reader(input), output(sink), buffer(flate::WindowSize + ChunkSize)
+    {
+    }
+
+    void inflate()
+    {
+        while (!inflateBlock())
+        {
+        }
+
+        flush();
+    }
+
+    // Whole blocks until at least limit bytes came out or the stream ended, true once the
+    // final block is done. The output may run past limit by the rest of the last block.
+    bool inflateUntil(uint64_t limit)
+    {
+        bool final = false;
+        while (!final && totalOut() < limit)
+        {
+            final = inflateBlock();
+        }
+
+        flush();
+        return final;
+    }
+
+    // Decodes from an access point instead of the start of the stream. The input must begin
+    // with the byte holding point.bit, totalOut() and crc32() then cover only the new output.
+    void resumeAt(const flate::AccessPoint &point)
+    {
+        if (point.window.size() > flate::WindowSize)
+        {
+            throw std::runtime_error("Access point window larger than 32 KiB");
+        }
+
+        reader.readBits(static_cast<unsigned>(point.bit & 7));
+        std::memcpy(buffer.data(), point.window.data(), point.window.size());
+        position = flushed = point.window.size();
+    }
+
+    // Leaves an access point in points at the first block boundary after every spacing
+    // bytes of output. Meant for decodes that start at the beginning of the stream.
+    void recordAccessPoints(std::vector<flate::AccessPoint> &points, uint64_t spacing)
+    {
+        accessPoints = &points;
+        accessPointSpacing = spacing;
+        nextAccessPoint = spacing;
+    }
+
+    uint64_t totalOut() const
+    {
+        return totalOutput + (position - flushed);
+    }
+
+    // CRC-32 of everything handed to the output so far
+    uint32_t crc32() const
+    {
+        return checksum.value();
+    }
+
+    // Compressed bytes consumed, valid once inflate() returned
+    size_t totalIn() const
+    {
+        return static_cast<size_t>((reader.bitPosition() + 7) >> 3);
+    }
+
+private:
+    // Returns true after the block marked final
+    bool inflateBlock()
+    {
+        if (accessPoints && totalOut() >= nextAccessPoint)
+        {
+            addAccessPoint();
+        }
+
+        const bool final = reader.readBit();
+        const unsigned type = static_cast<unsigned>(reader.readBits(2));
+
+        switch (type)
+        {
+        case 0:
+            ZIPREADER_COUNT(StoredBlocks, 1);
+            storedBlock();
+            break;
+        case 1:
+            ZIPREADER_COUNT(FixedBlocks, 1);
+            huffmanBlock(flate::fixedLiteralCodes(), flate::fixedDistanceCodes());
+            break;
+        case 2:
+            ZIPREADER_COUNT(DynamicBlocks, 1);
+            if (!flate::readDynamicTables(reader, literalCodes, distanceCodes))
+            {
+                throw std::runtime_error("Invalid dynamic block header");
+            }
+            huffmanBlock(literalCodes, distanceCodes);
+            break;
+        default:
+            throw std::runtime_error("Invalid deflate block type");
+        }
+
+        if (reader.overrun())
+        {
+            throw std::runtime_error("Unexpected end of deflate stream");
+        }
+
+        return final;
+    }
+
+    void storedBlock()
+    {
+        reader.alignToByte();
+
+        const uint32_t length = static_cast<uint32_t>(reader.readBits(16));
+        const uint32_t complement = static_cast<uint32_t>(reader.readBits(16));
+
+        if ((length ^ 0xffff) != complement)
+        {
+            throw std::runtime_error("Stored block length does not match its complement");
+        }
+
+        size_t remaining = length;
+        while (remaining)
+        {
+            ensureSpace(1);
+
+            const size_t count = std::min(remaining, buffer.size() - position);
+            reader.readBytes(buffer.data() + position, count);
+            position += count;
+            remaining -= count;
+        }
+    }
+
+    void huffmanBlock(const HuffmanTable &literals, const HuffmanTable &distances)
+    {
+        uint8_t *out = buffer.data();
+
+        for (;;)
+        {
+            // Common case: one refill covers a whole length/distance pair with its extra bits
+            // (15 + 5 + 15 + 13 = 48 of the 56), and the buffer has room for any match plus
+            // the overshoot of the wide copies, so nothing inside is checked twice
+            while (reader.hasFastInput() && position + FastOutputMargin <= buffer.size())
+            {
+                reader.refillFast();
+
+                uint32_t entry = literals.lookup(reader.peekFast());
+                if (entry & HuffmanTable::InvalidFlag)
+                {
+                    throw std::runtime_error("Invalid Huffman code in stream");
+                }
+                reader.consumeBits(entry & HuffmanTable::LengthMask);
+
+                unsigned symbol = entry >> 16;
+
+                if (symbol < 256)
+                {
+                    out[position++] = static_cast<uint8_t>(symbol);
+                    continue;
+                }
+
+                if (symbol == 256)
+                {
+                    return;
+                }
+
+                symbol -= 257;
+                if (symbol >= 29)
+                {
+                    throw std::runtime_error("Invalid length symbol");
+                }
+
+                const size_t length = flate::LengthBase[symbol] + takeFast(flate::LengthExtra[symbol]);
+
+                entry = distances.lookup(reader.peekFast());
+                if (entry & HuffmanTable::InvalidFlag)
+                {
+                    throw std::runtime_error("Invalid Huffman code in stream");
+                }
+                reader.consumeBits(entry & HuffmanTable::LengthMask);
+
+                const unsigned distanceSymbol = entry >> 16;
+                if (distanceSymbol >= 30)
+                {
+                    throw std::runtime_error("Invalid distance symbol");
+                }
+
+                const size_t distance = flate::DistanceBase[distanceSymbol] + takeFast(flate::DistanceExtra[distanceSymbol]);
+                if (distance > position)
+                {
+                    throw std::runtime_error("Back-reference distance too far back");
+                }
+
+                copyMatch(out + position, distance, length);
+                position += length;
+            }
+
+            // Near the end of the input or of the buffer: one symbol the careful way
+            ensureSpace(FastOutputMargin);
+
+            uint16_t symbol = literals.decode(reader);
+
+            if (symbol < 256)
+            {
+                out[position++] = static_cast<uint8_t>(symbol);
+                continue;
+            }
+
+            if (symbol == 256)
+            {
+                return;
+            }
+
+            symbol -= 257;
+            if (symbol >= 29)
+            {
+                throw std::runtime_error("Invalid length symbol");
+            }
+
+            const size_t length = flate::LengthBase[symbol] + reader.readBits(flate::LengthExtra[symbol]);
+
+            const uint16_t distanceSymbol = distances.decode(reader);
+            if (distanceSymbol >= 30)
+            {
+                throw std::runtime_error("Invalid distance symbol");
+            }
+
+            const size_t distance = flate::DistanceBase[distanceSymbol] + reader.readBits(flate::DistanceExtra[distanceSymbol]);
+            if (distance > position)
+            {
+                throw std::runtime_error("Back-reference distance too far back");
+            }
+
+            copyMatch(out + position, distance, length);
+            position += length;
+        }
+    }
+
+    // Extra bits inside the fast loop, the refill at the top already made sure they are there
+    size_t takeFast(unsigned bits)
+    {
+        const size_t value = static_cast<size_t>(reader.peekFast() & ((uint64_t(1) << bits) - 1));
+        reader.consumeBits(bits);
+        return value;
+    }
+
+    // Copies length bytes from distance back, whole 8 or 16 byte words at a time. The
+    // last word may run up to CopyOvershoot bytes past the match, the buffer always has
+    // that much room and the bytes are overwritten by whatever comes next.
+    static void copyMatch(uint8_t *to, size_t distance, size_t length)
+    {
+        const uint8_t *from = to - distance;
+        uint8_t *const stop = to + length;
+
+        if (distance >= 16)
+        {
+            do
+            {
+                std::memcpy(to, from, 16);
+                to += 16;
+                from += 16;
+            } while (to < stop);
+        }
+        else if (distance >= 8)
+        {
+            do
+            {
+                std::memcpy(to, from, 8);
+                to += 8;
+                from += 8;
+            } while (to < stop);
+        }
+        else if (distance == 1)
+        {
+            std::memset(to, *from, length);
+        }
+        else
+        {
+            // Short period: lay the pattern down byte by byte until it spans a multiple
+            // of distance that is at least 8, from there on words repeat at that step
+            const size_t step = distance * ((8 + distance - 1) / distance);
+
+            for (size_t i = 0; i < step; ++i)
+            {
+                to[i] = from[i];
+            }
+            for (to += step; to < stop; to += 8)
+            {
+                std::memcpy(to, to - step, 8);
+            }
+        }
+    }
+
+    void addAccessPoint()
+    {
+        // Everything up to position is still in the buffer, at least the last 32 KiB of it
+        const size_t window = std::min(position, flate::WindowSize);
+
+        flate::AccessPoint &point = accessPoints->emplace_back();
+        point.output = totalOut();
+        point.bit = reader.bitPosition();
+        point.window.assign(buffer.data() + position - window, buffer.data() + position);
+
+        nextAccessPoint = point.output + accessPointSpacing;
+    }
+
+    void ensureSpace(size_t bytes)
+    {
+        if (position + bytes > buffer.size())
+        {
+            flush();
+
+            // Keep the last 32 KiB around for back-references
+            const size_t keep = std::min(position, flate::WindowSize);
+            std::memmove(buffer.data(), buffer.data() + position - keep, keep);
+            position = keep;
+            flushed = keep;
+        }
+    }
+
+    void flush()
+    {
+        if (position > flushed)
+        {
+            {
+                ZIPREADER_TIME(Crc);
+                checksum.update(buffer.data() + flushed, position - flushed);
+            }
+            {
+                ZIPREADER_TIME(Output);
+                output.write(buffer.data() + flushed, position - flushed);
+            }
+            ZIPREADER_COUNT(BytesWritten, position - flushed);
+            totalOutput += position - flushed;
+            flushed = position;
+        }
+    }
+
+    BitReader reader;
+    Sink &output;
+    HuffmanTable literalCodes;
+    HuffmanTable distanceCodes;
+    Crc32 checksum;
+
+    std::vector<uint8_t> buffer;
+    size_t position = 0;
+    size_t flushed = 0;
+    uint64_t totalOutput = 0;
+
+    std::vector<flate::AccessPoint> *accessPoints = nullptr;
+    uint64_t accessPointSpacing = 0;
+    uint64_t nextAccessPoint = 0;
+};
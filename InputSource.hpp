@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <span>
+#include <utility>
+
+// Compressed input handed out piece by piece, so a decoder never needs the whole
+// stream in memory at once
+class InputSource
+{
+public:
+    virtual ~InputSource() = default;
+
+    // The next piece of input, an empty span once there is none left.
+    // The previous piece may be overwritten by this call.
+    virtual std::span<const uint8_t> next() = 0;
+};
+
+// Input that is already in memory, handed out in one piece
+class SpanSource : public InputSource
+{
+public:
+    explicit SpanSource(std::span<const uint8_t> input)
+        : remaining(input)
+    {
+    }
+
+    std::span<const uint8_t> next() override
+    {
+        return std::exchange(remaining, {});
+    }
+
+private:
+    std::span<const uint8_t> remaining;
+};
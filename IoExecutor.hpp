@@ -0,0 +1,301 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cerrno>
+#include <cstring>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "IoScheduler.hpp"
+#include "Task.hpp"
+#include "ThreadPool.hpp"
+
+namespace async
+{
+    class IoExecutor;
+
+    Task<> readExactly(IoExecutor &executor, int fd, uint64_t offset, std::span<uint8_t> into);
+    std::unique_ptr<IoExecutor> makeIoExecutor(size_t threads = 4);
+
+    // Where coroutines send their reads. Awaiting read() suspends the coroutine and hands
+    // the read to the executor; once it is done the coroutine is resumed from poll(), so
+    // every coroutine runs on the thread that polls, however the reads are carried out.
+    // An event loop calls poll(false) whenever it comes around, anything else can use blockOn.
+    class IoExecutor
+    {
+    public:
+        // One positioned read. Lives in the frame of the coroutine awaiting it until that
+        // is resumed, the executor only ever holds on to it by pointer.
+        class Read
+        {
+        public:
+            Read(IoExecutor &owner, int descriptor, uint64_t position, std::span<uint8_t> into)
+                : executor(owner), fd(descriptor), offset(position), buffer(into)
+            {
+            }
+
+            bool await_ready() const noexcept
+            {
+                return buffer.empty();
+            }
+
+            void await_suspend(std::coroutine_handle<> awaiting)
+            {
+                waiting = awaiting;
+                ++executor.outstanding;
+                executor.start(*this);
+            }
+
+            // Bytes read, fewer than asked for only at the end of the file
+            size_t await_resume() const
+            {
+                if (result < 0)
+                {
+                    throw std::runtime_error(std::string("Read failed: ") + std::strerror(static_cast<int>(-result)));
+                }
+                return static_cast<size_t>(result);
+            }
+
+            IoExecutor &executor;
+            const int fd;
+            const uint64_t offset;
+            const std::span<uint8_t> buffer;
+            // For executors that need the buffer as an iovec that stays put
+            iovec vector{};
+            ssize_t result = 0;
+
+        private:
+            friend class IoExecutor;
+            std::coroutine_handle<> waiting;
+        };
+
+        virtual ~IoExecutor() = default;
+
+        Read read(int fd, uint64_t offset, std::span<uint8_t> into)
+        {
+            return Read(*this, fd, offset, into);
+        }
+
+        // Resumes the coroutines whose reads are done and returns how many. With wait it
+        // first blocks until there is at least one, unless no read is outstanding at all.
+        virtual size_t poll(bool wait) = 0;
+
+        // Reads handed over whose coroutines were not resumed yet
+        size_t inFlight() const
+        {
+            return outstanding;
+        }
+
+    protected:
+        virtual void start(Read &read) = 0;
+
+        // result is the byte count or -errno
+        void complete(Read &read, ssize_t result)
+        {
+            --outstanding;
+            read.result = result;
+            read.waiting.resume();
+        }
+
+    private:
+        size_t outstanding = 0;
+    };
+
+    // Runs the task to completion on this thread, polling the executor while it waits
+    template <typename T>
+    T blockOn(IoExecutor &executor, Task<T> task)
+    {
+        task.start();
+
+        while (!task.done())
+        {
+            if (executor.poll(true) == 0 && executor.inFlight() == 0 && !task.done())
+            {
+                throw std::logic_error("Task is suspended on something other than its executor");
+            }
+        }
+        return task.result();
+    }
+
+    // Plain preads on a few pool threads, for when io_uring is not there. Finished reads
+    // queue up until poll() resumes their coroutines on the polling thread.
+    class ThreadPoolExecutor : public IoExecutor
+    {
+    public:
+        explicit ThreadPoolExecutor(size_t threads = 4)
+            : pool(threads)
+        {
+        }
+
+        size_t poll(bool wait) override
+        {
+            std::vector<std::pair<Read *, ssize_t>> ready;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (wait && inFlight() > 0)
+                {
+                    completion.wait(lock, [this]
+                                    { return !finished.empty(); });
+                }
+                ready.swap(finished);
+            }
+
+            for (const auto &[read, result] : ready)
+            {
+                complete(*read, result);
+            }
+            return ready.size();
+        }
+
+    protected:
+        void start(Read &read) override
+        {
+            pool.submit([this, &read]
+                        {
+                ssize_t result;
+                do
+                {
+                    result = ::pread(read.fd, read.buffer.data(), read.buffer.size(), static_cast<off_t>(read.offset));
+                } while (result < 0 && errno == EINTR);
+
+                const ssize_t outcome = result < 0 ? -errno : result;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    finished.emplace_back(&read, outcome);
+                }
+                completion.notify_one(); });
+        }
+
+    private:
+        std::mutex mutex;
+        std::condition_variable completion;
+        std::vector<std::pair<Read *, ssize_t>> finished;
+        // Last, so its workers are gone before what they report to
+        ThreadPool pool;
+    };
+
+#ifdef ZIPREADER_HAVE_IO_URING
+    // Reads go to the kernel through one io_uring and are reaped by poll(). The ring is
+    // kept at most QueueDepth deep, reads beyond that wait their turn in a queue.
+    class IoUringExecutor : public IoExecutor
+    {
+    public:
+        static constexpr unsigned QueueDepth = 64;
+
+        IoUringExecutor()
+            : ring(QueueDepth)
+        {
+        }
+
+        bool available() const
+        {
+            return ring.available();
+        }
+
+        size_t poll(bool wait) override
+        {
+            if (inRing == 0)
+            {
+                return 0;
+            }
+
+            std::vector<std::pair<Read *, ssize_t>> ready;
+            const auto reap = [this, &ready]
+            {
+                ring.reap([&ready](uint64_t tag, int result)
+                          { ready.emplace_back(reinterpret_cast<Read *>(tag), result); });
+            };
+
+            reap();
+            if (ready.empty() && wait)
+            {
+                ring.waitFor(1);
+                reap();
+            }
+            inRing -= static_cast<unsigned>(ready.size());
+
+            while (!backlog.empty() && inRing < QueueDepth)
+            {
+                queue(*backlog.front());
+                backlog.pop_front();
+            }
+            ring.submit();
+
+            for (const auto &[read, result] : ready)
+            {
+                complete(*read, result);
+            }
+            return ready.size();
+        }
+
+    protected:
+        void start(Read &read) override
+        {
+            if (inRing == QueueDepth)
+            {
+                backlog.push_back(&read);
+                return;
+            }
+
+            queue(read);
+            ring.submit();
+        }
+
+    private:
+        void queue(Read &read)
+        {
+            read.vector = {read.buffer.data(), read.buffer.size()};
+            ring.queueRead(read.fd, &read.vector, 1, read.offset, reinterpret_cast<uint64_t>(&read));
+            ++inRing;
+        }
+
+        IoRing ring;
+        unsigned inRing = 0;
+        std::deque<Read *> backlog;
+    };
+#endif
+
+    // Fills into completely from offset on, short only if the file ends first, which throws
+    inline Task<> readExactly(IoExecutor &executor, int fd, uint64_t offset, std::span<uint8_t> into)
+    {
+        while (!into.empty())
+        {
+            const size_t got = co_await executor.read(fd, offset, into);
+
+            if (got == 0)
+            {
+                throw std::runtime_error("Unexpected end of file");
+            }
+
+            ZIPREADER_COUNT(BytesRead, got);
+            offset += got;
+            into = into.subspan(got);
+        }
+    }
+
+    // io_uring when the kernel lets us have it, a thread pool doing preads otherwise
+    inline std::unique_ptr<IoExecutor> makeIoExecutor(size_t threads)
+    {
+#ifdef ZIPREADER_HAVE_IO_URING
+        std::unique_ptr<IoUringExecutor> ring = std::make_unique<IoUringExecutor>();
+        if (ring->available())
+        {
+            return ring;
+        }
+#endif
+        return std::make_unique<ThreadPoolExecutor>(threads);
+    }
+}
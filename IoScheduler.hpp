@@ -0,0 +1,531 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "ArchiveFile.hpp"
+#include "CentralDirectoryIndex.hpp"
+#include "Stats.hpp"
+
+// io_uring is driven through the raw syscalls, there is no liburing to link against.
+// -DZIPREADER_NO_IO_URING forces the pread path.
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup) && !defined(ZIPREADER_NO_IO_URING)
+#include <linux/io_uring.h>
+#define ZIPREADER_HAVE_IO_URING
+#endif
+
+#ifdef ZIPREADER_HAVE_IO_URING
+
+// Minimal io_uring: queue positioned reads, submit them with one syscall, collect the
+// completions. A kernel or sandbox without io_uring just leaves the ring unavailable.
+class IoRing
+{
+public:
+    explicit IoRing(unsigned entries)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+
+        const long fd = ::syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0)
+        {
+            return;
+        }
+        ringFd = static_cast<int>(fd);
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        sqeSize = params.sq_entries * sizeof(io_uring_sqe);
+
+        // Newer kernels map both rings with one mmap
+        const bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap)
+        {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+
+        sqRing = ::mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        cqRing = singleMap ? sqRing : ::mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        void *sqeMemory = ::mmap(nullptr, sqeSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqeMemory == MAP_FAILED)
+        {
+            if (sqeMemory != MAP_FAILED)
+            {
+                ::munmap(sqeMemory, sqeSize);
+            }
+            release();
+            return;
+        }
+
+        sqTail = field<uint32_t>(sqRing, params.sq_off.tail);
+        sqMask = *field<uint32_t>(sqRing, params.sq_off.ring_mask);
+        sqArray = field<uint32_t>(sqRing, params.sq_off.array);
+        cqHead = field<uint32_t>(cqRing, params.cq_off.head);
+        cqTail = field<uint32_t>(cqRing, params.cq_off.tail);
+        cqMask = *field<uint32_t>(cqRing, params.cq_off.ring_mask);
+        cqes = field<io_uring_cqe>(cqRing, params.cq_off.cqes);
+        sqes = static_cast<io_uring_sqe *>(sqeMemory);
+    }
+
+    IoRing(const IoRing &) = delete;
+    IoRing &operator=(const IoRing &) = delete;
+
+    ~IoRing()
+    {
+        if (sqes)
+        {
+            ::munmap(sqes, sqeSize);
+        }
+        release();
+    }
+
+    bool available() const
+    {
+        return sqes != nullptr;
+    }
+
+    // The iovecs must stay put until the read completes
+    void queueRead(int fd, const iovec *buffers, unsigned count, uint64_t offset, uint64_t tag)
+    {
+        // Only this thread ever moves the submission tail
+        const uint32_t tail = *sqTail;
+        const uint32_t slot = tail & sqMask;
+
+        io_uring_sqe &sqe = sqes[slot];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READV;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<uint64_t>(buffers);
+        sqe.len = count;
+        sqe.off = offset;
+        sqe.user_data = tag;
+
+        sqArray[slot] = slot;
+        std::atomic_ref<uint32_t>(*sqTail).store(tail + 1, std::memory_order_release);
+        ++queued;
+    }
+
+    // Hands everything queued to the kernel without waiting for any of it
+    void submit()
+    {
+        while (queued)
+        {
+            queued -= enter(queued, 0, 0);
+        }
+    }
+
+    // Blocks until at least count completions are waiting to be reaped
+    void waitFor(unsigned count)
+    {
+        enter(0, count, IORING_ENTER_GETEVENTS);
+    }
+
+    // Calls completion(tag, result) for every finished read, result is bytes read or -errno
+    template <typename Completion>
+    unsigned reap(Completion &&completion)
+    {
+        uint32_t head = *cqHead;
+        const uint32_t tail = std::atomic_ref<uint32_t>(*cqTail).load(std::memory_order_acquire);
+        unsigned reaped = 0;
+
+        for (; head != tail; ++head, ++reaped)
+        {
+            const io_uring_cqe &cqe = cqes[head & cqMask];
+            completion(cqe.user_data, cqe.res);
+        }
+
+        std::atomic_ref<uint32_t>(*cqHead).store(head, std::memory_order_release);
+        return reaped;
+    }
+
+private:
+    template <typename T>
+    static T *field(void *ring, uint32_t offset)
+    {
+        return static_cast<T *>(static_cast<void *>(static_cast<uint8_t *>(ring) + offset));
+    }
+
+    unsigned enter(unsigned toSubmit, unsigned minComplete, unsigned flags)
+    {
+        for (;;)
+        {
+            ZIPREADER_COUNT(ReadCalls, 1);
+            const long result = ::syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0);
+
+            if (result >= 0)
+            {
+                return static_cast<unsigned>(result);
+            }
+            if (errno != EINTR)
+            {
+                throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+            }
+        }
+    }
+
+    void release()
+    {
+        if (cqRing != MAP_FAILED && cqRing != sqRing)
+        {
+            ::munmap(cqRing, cqRingSize);
+        }
+        if (sqRing != MAP_FAILED)
+        {
+            ::munmap(sqRing, sqRingSize);
+        }
+        if (ringFd >= 0)
+        {
+            ::close(ringFd);
+        }
+    }
+
+    int ringFd = -1;
+    void *sqRing = MAP_FAILED;
+    void *cqRing = MAP_FAILED;
+    size_t sqRingSize = 0, cqRingSize = 0, sqeSize = 0;
+
+    uint32_t *sqTail = nullptr, *sqArray = nullptr, *cqHead = nullptr, *cqTail = nullptr;
+    uint32_t sqMask = 0, cqMask = 0;
+    io_uring_sqe *sqes = nullptr;
+    io_uring_cqe *cqes = nullptr;
+    unsigned queued = 0;
+};
+
+#endif
+
+// Plans and performs the reads for extracting many small entries. Entries are sorted by
+// local header offset and neighbours are merged into runs, each run covering the local
+// headers and data of several entries and read with a single request. Runs are grouped
+// into batches that go to the kernel together: one io_uring submission, or where io_uring
+// is missing a pread per run on a helper thread. For a mapped archive nothing is copied,
+// the batch only asks the kernel to page its runs in ahead of the page faults.
+//
+// Used from one thread: begin() a batch, then complete() it. The next batch can be begun
+// right after, its reads then overlap with the extraction of the one just completed.
+class IoScheduler
+{
+public:
+    // Bigger entries are streamed by the extractor as before, read ahead would not help them
+    static constexpr uint64_t MaxEntrySize = 256 * 1024;
+    // Holes between entries up to this size are read along rather than seeked over
+    static constexpr uint64_t MaxGap = 4096;
+    static constexpr uint64_t MaxRunSize = 1024 * 1024;
+    static constexpr uint64_t MaxBatchSize = 8 * 1024 * 1024;
+    static constexpr unsigned QueueDepth = 32;
+    // The central directory does not know how long the local extra field is
+    static constexpr uint64_t LocalExtraAllowance = 256;
+
+    // An entry's bytes starting at its local header, as far as they were read
+    struct Prefetched
+    {
+        uint32_t entry;
+        std::span<const uint8_t> bytes;
+    };
+
+    struct Batch
+    {
+        std::vector<Prefetched> entries;
+        std::vector<uint8_t> storage;
+    };
+
+    IoScheduler(const ArchiveFile &archive, const CentralDirectoryIndex &index)
+        : file(archive)
+#ifdef ZIPREADER_HAVE_IO_URING
+          ,
+          // A mapping is only ever hinted at, it has no use for a ring
+          ring(archive.mapped() ? 0 : QueueDepth)
+#endif
+    {
+        plan(index);
+    }
+
+    // Entries too big to be batched, biggest first
+    const std::vector<uint32_t> &largeEntries() const
+    {
+        return large;
+    }
+
+    size_t batchCount() const
+    {
+        return batches.size();
+    }
+
+    void begin(size_t batch)
+    {
+        const PlannedBatch &planned = batches[batch];
+
+        current = {};
+        currentBatch = batch;
+        failed.clear();
+
+        if (file.mapped())
+        {
+            for (size_t run = planned.firstRun; run < planned.firstRun + planned.runCount; ++run)
+            {
+                file.willNeed(runs[run].offset, runs[run].length);
+            }
+            return;
+        }
+
+        current.storage.resize(planned.size);
+        vectors.resize(planned.runCount);
+
+        size_t position = 0;
+        for (size_t i = 0; i < planned.runCount; ++i)
+        {
+            vectors[i] = {current.storage.data() + position, static_cast<size_t>(runs[planned.firstRun + i].length)};
+            position += vectors[i].iov_len;
+        }
+
+#ifdef ZIPREADER_HAVE_IO_URING
+        if (ring.available())
+        {
+            for (size_t i = 0; i < planned.runCount; ++i)
+            {
+                ring.queueRead(file.descriptor(), &vectors[i], 1, runs[planned.firstRun + i].offset, i);
+            }
+            ring.submit();
+            return;
+        }
+#endif
+
+        // Without io_uring a helper thread reads the runs one by one, that still overlaps
+        // with the extraction of the batch completed before
+        std::vector<std::pair<iovec, uint64_t>> reads(planned.runCount);
+        for (size_t i = 0; i < planned.runCount; ++i)
+        {
+            reads[i] = {vectors[i], runs[planned.firstRun + i].offset};
+        }
+
+        reader = std::jthread([this, reads = std::move(reads)]
+                              {
+            try
+            {
+                for (const auto &[vector, offset] : reads)
+                {
+                    readRun(vector, offset);
+                }
+            }
+            catch (...)
+            {
+                readError = std::current_exception();
+            } });
+    }
+
+    // Waits for the batch begun last and hands out its entries
+    Batch complete()
+    {
+        ZIPREADER_TIME(Read);
+
+        const PlannedBatch &planned = batches[currentBatch];
+
+        if (!file.mapped())
+        {
+            if (reader.joinable())
+            {
+                reader.join();
+
+                if (readError)
+                {
+                    std::rethrow_exception(std::exchange(readError, nullptr));
+                }
+            }
+
+#ifdef ZIPREADER_HAVE_IO_URING
+            if (ring.available())
+            {
+                for (unsigned outstanding = static_cast<unsigned>(planned.runCount); outstanding;)
+                {
+                    ring.waitFor(outstanding);
+                    outstanding -= ring.reap([this](uint64_t run, int result)
+                                             {
+                        // Short reads and errors get another go through pread, which reports properly
+                        if (result < 0 || static_cast<size_t>(result) != vectors[run].iov_len)
+                        {
+                            failed.push_back(static_cast<size_t>(run));
+                        } });
+                }
+            }
+#endif
+            for (const size_t run : failed)
+            {
+                readRun(vectors[run], runs[planned.firstRun + run].offset);
+            }
+
+            ZIPREADER_COUNT(BytesRead, planned.size);
+            ZIPREADER_COUNT(Seeks, planned.runCount);
+        }
+
+        std::vector<uint8_t> unused;
+        size_t position = 0;
+
+        for (size_t run = planned.firstRun; run < planned.firstRun + planned.runCount; ++run)
+        {
+            const Run &r = runs[run];
+
+            for (size_t i = r.firstEntry; i < r.firstEntry + r.entryCount; ++i)
+            {
+                const PlannedEntry &entry = entries[i];
+                const size_t length = static_cast<size_t>(entry.length);
+
+                if (file.mapped())
+                {
+                    current.entries.push_back({entry.entry, file.read(entry.offset, length, unused)});
+                }
+                else
+                {
+                    const size_t start = position + static_cast<size_t>(entry.offset - r.offset);
+                    current.entries.push_back({entry.entry, std::span<const uint8_t>(current.storage).subspan(start, length)});
+                }
+            }
+
+            position += static_cast<size_t>(r.length);
+        }
+
+        return std::move(current);
+    }
+
+private:
+    struct PlannedEntry
+    {
+        uint32_t entry;
+        uint64_t offset, length;
+    };
+
+    struct Run
+    {
+        uint64_t offset, length;
+        size_t firstEntry, entryCount;
+    };
+
+    struct PlannedBatch
+    {
+        size_t firstRun, runCount;
+        uint64_t size;
+    };
+
+    void plan(const CentralDirectoryIndex &index)
+    {
+        std::vector<uint32_t> order(index.size());
+        for (uint32_t i = 0; i < order.size(); ++i)
+        {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&index](uint32_t a, uint32_t b)
+                  { return index.entry(a).localHeaderOffset < index.entry(b).localHeaderOffset; });
+
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            const EntryInfo entry = index.entry(order[i]);
+
+            if (entry.compressedSize > MaxEntrySize || entry.localHeaderOffset >= file.size())
+            {
+                large.push_back(order[i]);
+                continue;
+            }
+
+            // An entry ends where the next one starts, or a little after its data when that is closer
+            const uint64_t next = i + 1 < order.size() ? std::max(entry.localHeaderOffset, index.entry(order[i + 1]).localHeaderOffset) : file.size();
+            const uint64_t estimate = entry.localHeaderOffset + 30 + entry.name.size() + LocalExtraAllowance + entry.compressedSize;
+            const uint64_t end = std::min({next, estimate, file.size()});
+
+            if (!runs.empty())
+            {
+                Run &run = runs.back();
+                PlannedEntry &previous = entries.back();
+                const uint64_t runEnd = run.offset + run.length;
+
+                // Sorted and clamped to the next offset, so the run never ends past this entry
+                if (entry.localHeaderOffset - runEnd <= MaxGap && end - run.offset <= MaxRunSize)
+                {
+                    // The hole, if any, is read along and handed to the previous entry
+                    if (entry.localHeaderOffset > runEnd)
+                    {
+                        previous.length += entry.localHeaderOffset - runEnd;
+                    }
+
+                    entries.push_back({order[i], entry.localHeaderOffset, end - entry.localHeaderOffset});
+                    run.length = end - run.offset;
+                    ++run.entryCount;
+                    continue;
+                }
+            }
+
+            entries.push_back({order[i], entry.localHeaderOffset, end - entry.localHeaderOffset});
+            runs.push_back({entry.localHeaderOffset, end - entry.localHeaderOffset, entries.size() - 1, 1});
+        }
+
+        for (size_t run = 0; run < runs.size(); ++run)
+        {
+            if (batches.empty() || batches.back().runCount == QueueDepth || batches.back().size + runs[run].length > MaxBatchSize)
+            {
+                batches.push_back({run, 0, 0});
+            }
+
+            ++batches.back().runCount;
+            batches.back().size += runs[run].length;
+        }
+
+        std::sort(large.begin(), large.end(), [&index](uint32_t a, uint32_t b)
+                  { return index.entry(a).compressedSize > index.entry(b).compressedSize; });
+    }
+
+    void readRun(iovec vector, uint64_t offset)
+    {
+        while (vector.iov_len)
+        {
+            const ssize_t got = ::pread(file.descriptor(), vector.iov_base, vector.iov_len, static_cast<off_t>(offset));
+            ZIPREADER_COUNT(ReadCalls, 1);
+
+            if (got < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (got <= 0)
+            {
+                throw std::runtime_error(std::string("Error reading archive: ") + (got < 0 ? std::strerror(errno) : "unexpected end of file"));
+            }
+
+            vector.iov_base = static_cast<uint8_t *>(vector.iov_base) + got;
+            vector.iov_len -= static_cast<size_t>(got);
+            offset += static_cast<uint64_t>(got);
+        }
+    }
+
+    const ArchiveFile &file;
+    std::vector<PlannedEntry> entries;
+    std::vector<Run> runs;
+    std::vector<PlannedBatch> batches;
+    std::vector<uint32_t> large;
+
+    Batch current;
+    size_t currentBatch = 0;
+    std::vector<iovec> vectors;
+    std::vector<size_t> failed;
+
+#ifdef ZIPREADER_HAVE_IO_URING
+    IoRing ring;
+#endif
+
+    // Reads the batch begun last when there is no ring. Last, so it is joined before the
+    // storage it reads into goes.
+    std::jthread reader;
+    std::exception_ptr readError;
+};
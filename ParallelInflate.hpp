@@ -0,0 +1,516 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <deque>
+#include <latch>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "BitReader.hpp"
+#include "Crc32.hpp"
+#include "Huffman.hpp"
+#include "Inflate.hpp"
+#include "Sink.hpp"
+#include "Stats.hpp"
+#include "ThreadPool.hpp"
+
+namespace flate
+{
+    // Output slots from WindowMarker on stand for byte (value - WindowMarker) of the
+    // 32 KiB window in front of a chunk, which is not known yet while the chunk decodes
+    constexpr uint16_t WindowMarker = 256;
+
+    // Whole blocks decoded from startBit on. symbols starts with the WindowSize slots of
+    // the window, known bytes or markers, and continues with the decoded output.
+    struct DecodedChunk
+    {
+        std::vector<uint16_t> symbols;
+        uint64_t startBit = 0, endBit = 0;
+        bool final = false;
+
+        std::span<const uint16_t> output() const
+        {
+            return std::span<const uint16_t>(symbols).subspan(WindowSize);
+        }
+    };
+
+    // Decodes blocks from startBit until the first block boundary at or past stopBit, the
+    // final block, or a boundary past maxOutput bytes of output. window holds what is known
+    // of the bytes right before startBit, everything older turns into markers. Throws on
+    // anything that is not valid deflate.
+    inline DecodedChunk decodeChunk(std::span<const uint8_t> data, uint64_t startBit, uint64_t stopBit, std::span<const uint8_t> window, size_t maxOutput)
+    {
+        const size_t startByte = static_cast<size_t>(startBit / 8);
+        BitReader reader(data.data() + startByte, data.size() - startByte);
+        reader.readBits(static_cast<unsigned>(startBit % 8));
+
+        DecodedChunk chunk;
+        chunk.startBit = startBit;
+
+        std::vector<uint16_t> &out = chunk.symbols;
+        out.resize(WindowSize * 4);
+
+        const size_t known = std::min(window.size(), WindowSize);
+        for (size_t i = 0; i < WindowSize - known; ++i)
+        {
+            out[i] = static_cast<uint16_t>(WindowMarker + i);
+        }
+        std::copy(window.end() - static_cast<std::ptrdiff_t>(known), window.end(), out.begin() + static_cast<std::ptrdiff_t>(WindowSize - known));
+
+        size_t position = WindowSize;
+        HuffmanTable literalCodes, distanceCodes;
+        std::vector<uint8_t> stored;
+
+        for (;;)
+        {
+            const uint64_t bit = startByte * 8 + reader.bitPosition();
+
+            if (bit >= stopBit || position - WindowSize >= maxOutput)
+            {
+                chunk.endBit = bit;
+                break;
+            }
+
+            const bool final = reader.readBit();
+            const unsigned type = static_cast<unsigned>(reader.readBits(2));
+            const HuffmanTable *literals = &literalCodes;
+            const HuffmanTable *distances = &distanceCodes;
+
+            if (type == 0)
+            {
+                reader.alignToByte();
+
+                const uint32_t length = static_cast<uint32_t>(reader.readBits(16));
+                if ((length ^ 0xffff) != reader.readBits(16))
+                {
+                    throw std::runtime_error("Stored block length does not match its complement");
+                }
+
+                stored.resize(length);
+                reader.readBytes(stored.data(), length);
+
+                if (out.size() - position < length)
+                {
+                    out.resize(std::max(out.size() * 2, position + length));
+                }
+                std::copy(stored.begin(), stored.end(), out.begin() + static_cast<std::ptrdiff_t>(position));
+                position += length;
+            }
+            else if (type == 1)
+            {
+                literals = &fixedLiteralCodes();
+                distances = &fixedDistanceCodes();
+            }
+            else if (type != 2 || !readDynamicTables(reader, literalCodes, distanceCodes))
+            {
+                throw std::runtime_error("Invalid deflate block header");
+            }
+
+            // Same symbol loop as Inflater, one refill per symbol covers a whole length/distance pair
+            while (type != 0)
+            {
+                if (out.size() - position < MaxMatch)
+                {
+                    out.resize(out.size() * 2);
+                }
+
+                reader.refill();
+
+                uint32_t entry = literals->lookup(reader.peekFast());
+                if (entry & HuffmanTable::InvalidFlag)
+                {
+                    throw std::runtime_error("Invalid Huffman code in stream");
+                }
+                reader.consumeBits(entry & HuffmanTable::LengthMask);
+
+                unsigned symbol = entry >> 16;
+
+                if (symbol < 256)
+                {
+                    out[position++] = static_cast<uint16_t>(symbol);
+                    continue;
+                }
+
+                if (symbol == 256)
+                {
+                    break;
+                }
+
+                symbol -= 257;
+                if (symbol >= 29)
+                {
+                    throw std::runtime_error("Invalid length symbol");
+                }
+
+                const size_t length = LengthBase[symbol] + reader.readBits(LengthExtra[symbol]);
+
+                entry = distances->lookup(reader.peekFast());
+                if (entry & HuffmanTable::InvalidFlag)
+                {
+                    throw std::runtime_error("Invalid Huffman code in stream");
+                }
+                reader.consumeBits(entry & HuffmanTable::LengthMask);
+
+                const unsigned distanceSymbol = entry >> 16;
+                if (distanceSymbol >= 30)
+                {
+                    throw std::runtime_error("Invalid distance symbol");
+                }
+
+                // Never further back than the window slots, which are always there
+                const size_t distance = DistanceBase[distanceSymbol] + reader.readBits(DistanceExtra[distanceSymbol]);
+
+                // Markers are copied like any other byte, that is what makes the window resolvable later
+                for (size_t i = 0; i < length; ++i)
+                {
+                    out[position + i] = out[position - distance + i];
+                }
+                position += length;
+            }
+
+            if (reader.overrun())
+            {
+                throw std::runtime_error("Unexpected end of deflate stream");
+            }
+
+            if (final)
+            {
+                chunk.final = true;
+                chunk.endBit = startByte * 8 + reader.bitPosition();
+                break;
+            }
+        }
+
+        out.resize(position);
+        return chunk;
+    }
+
+    // Most a dynamic block header can take from the byte it starts in: 7 bits to its start,
+    // the 3 + 14 bit header, 19 code length codes and 316 lengths of at most 7 + 7 bits
+    constexpr size_t MaxDynamicHeaderBytes = (7 + 17 + 19 * 3 + (286 + 30) * 14 + 7) / 8;
+
+    // First bit offset in [fromBit, toBit) where a non-final dynamic block header with
+    // valid code tables starts, toBit if there is none. Complete Huffman codes are rare in
+    // random bits, so almost every hit is a real block; decoding weeds out the rest.
+    // Candidates are tested for every bit of a chunk, so nothing here throws, and the
+    // tables only allocate once the code length code turned out complete.
+    inline uint64_t findBlockStart(std::span<const uint8_t> data, uint64_t fromBit, uint64_t toBit)
+    {
+        HuffmanTable literalCodes, distanceCodes;
+        // Zero padded copy of the last bytes, read instead of the data near its end so the
+        // reader never runs out
+        uint8_t tail[MaxDynamicHeaderBytes];
+
+        for (uint64_t bit = fromBit; bit < toBit; ++bit)
+        {
+            const size_t byte = static_cast<size_t>(bit / 8);
+            const size_t available = data.size() - byte;
+
+            if (available < 8)
+            {
+                break;
+            }
+
+            uint64_t word;
+            std::memcpy(&word, data.data() + byte, sizeof(word));
+            if constexpr (std::endian::native == std::endian::big)
+            {
+                word = __builtin_bswap64(word);
+            }
+            word >>= bit % 8;
+
+            // BFINAL 0 and BTYPE 2, then HLIT and HDIST no higher than 29
+            if ((word & 7) != 4 || ((word >> 3) & 31) > 29 || ((word >> 8) & 31) > 29)
+            {
+                continue;
+            }
+
+            // When the word holds them, the code length code lengths are summed up first: a
+            // usable code fills its code space exactly, or half of it with the single code of
+            // length 1 that build() lets through
+            const unsigned HCLEN = static_cast<unsigned>((word >> 13) & 15) + 4;
+            if (bit % 8 + 17 + HCLEN * 3 <= 64)
+            {
+                unsigned space = 0;
+                for (unsigned i = 0; i < HCLEN; ++i)
+                {
+                    const unsigned length = (word >> (17 + i * 3)) & 7;
+                    space += length ? 128u >> length : 0;
+                }
+                if (space != 128 && space != 64)
+                {
+                    continue;
+                }
+            }
+
+            BitReader reader;
+            if (available >= MaxDynamicHeaderBytes)
+            {
+                reader = BitReader(data.data() + byte, available);
+            }
+            else
+            {
+                std::memcpy(tail, data.data() + byte, available);
+                std::memset(tail + available, 0, sizeof(tail) - available);
+                reader = BitReader(tail, sizeof(tail));
+            }
+            reader.readBits(static_cast<unsigned>(bit % 8) + 3);
+
+            if (readDynamicTables(reader, literalCodes, distanceCodes) && reader.bitPosition() <= available * 8)
+            {
+                return bit;
+            }
+        }
+
+        return toBit;
+    }
+}
+
+// Decodes one large deflate stream on several cores, the way rapidgzip and pugz do. The
+// input is cut into chunks. Every chunk but the first looks for a plausible dynamic block
+// header inside it, decodes from there with markers for the window it cannot know yet and
+// stops at the first block boundary past its end. Then, in order, each chunk must start
+// exactly where its predecessor stopped, its markers are filled in from the window now
+// known and the bytes go to the sink. A chunk that guessed wrong is decoded again from the
+// right place on the calling thread, so the output always matches a sequential inflate.
+class ParallelInflater
+{
+public:
+    static constexpr size_t DefaultChunkSize = 4 * 1024 * 1024;
+    // Below this a single core does the job just as fast
+    static constexpr size_t MinimumInput = 4 * DefaultChunkSize;
+    // Bounds the memory a chunk of extremely compressible data can take
+    static constexpr size_t MaxChunkOutput = 64 * 1024 * 1024;
+
+    ParallelInflater(std::span<const uint8_t> data, Sink &sink, size_t threads, size_t chunkBytes = DefaultChunkSize)
+        : input(data), output(sink), threadCount(std::max<size_t>(threads, 1)), chunkSize(std::max<size_t>(chunkBytes, 1))
+    {
+    }
+
+    void inflate()
+    {
+        const uint64_t totalBits = static_cast<uint64_t>(input.size()) * 8;
+        const size_t chunkCount = std::max<size_t>((input.size() + chunkSize - 1) / chunkSize, 1);
+        // Decoded chunks waiting for their turn hold memory, run only one ahead of the workers
+        const size_t lookahead = threadCount + 1;
+
+        std::atomic<bool> cancelled{false};
+        std::deque<std::shared_ptr<Speculation>> inFlight;
+        ThreadPool pool(threadCount);
+
+        const auto speculate = [this, &pool, &inFlight, &cancelled](size_t chunk)
+        {
+            const std::shared_ptr<Speculation> speculation = std::make_shared<Speculation>();
+            inFlight.push_back(speculation);
+
+            pool.submit([this, speculation, chunk, &cancelled]
+                        {
+                if (!cancelled)
+                {
+                    decodeSpeculatively(chunk, *speculation, cancelled);
+                }
+                speculation->done.count_down(); });
+        };
+
+        try
+        {
+            for (size_t chunk = 0; chunk < std::min(chunkCount, lookahead); ++chunk)
+            {
+                speculate(chunk);
+            }
+
+            uint64_t expected = 0;
+            bool finished = false;
+
+            for (size_t chunk = 0; chunk < chunkCount && !finished; ++chunk)
+            {
+                const std::shared_ptr<Speculation> speculation = inFlight.front();
+                inFlight.pop_front();
+
+                if (chunk + lookahead < chunkCount)
+                {
+                    speculate(chunk + lookahead);
+                }
+
+                speculation->done.wait();
+
+                const uint64_t chunkEnd = std::min<uint64_t>(static_cast<uint64_t>(chunk + 1) * chunkSize * 8, totalBits);
+
+                // An earlier chunk ended up running through this one as well
+                if (expected >= chunkEnd)
+                {
+                    continue;
+                }
+
+                if (!speculation->valid || speculation->chunk.startBit != expected)
+                {
+                    ZIPREADER_TIME(Inflate);
+                    speculation->chunk = flate::decodeChunk(input, expected, chunkEnd, window, MaxChunkOutput);
+                }
+
+                emit(speculation->chunk);
+                expected = speculation->chunk.endBit;
+                finished = speculation->chunk.final;
+            }
+
+            // Only left over when a chunk stopped early at its output limit, or when the
+            // input ran out without a final block
+            while (!finished)
+            {
+                if (expected >= totalBits)
+                {
+                    throw std::runtime_error("Unexpected end of deflate stream");
+                }
+
+                ZIPREADER_TIME(Inflate);
+                const flate::DecodedChunk chunk = flate::decodeChunk(input, expected, totalBits, window, MaxChunkOutput);
+
+                if (!chunk.final && chunk.endBit <= expected)
+                {
+                    throw std::runtime_error("Unexpected end of deflate stream");
+                }
+
+                emit(chunk);
+                expected = chunk.endBit;
+                finished = chunk.final;
+            }
+        }
+        catch (...)
+        {
+            cancelled = true;
+            throw;
+        }
+
+        // Whatever is still queued belongs past the final block
+        cancelled = true;
+    }
+
+    uint64_t totalOut() const
+    {
+        return totalOutput;
+    }
+
+    uint32_t crc32() const
+    {
+        return checksum.value();
+    }
+
+private:
+    struct Speculation
+    {
+        std::latch done{1};
+        flate::DecodedChunk chunk;
+        bool valid = false;
+    };
+
+    // Runs on a worker, failing is fine: the chunk is then simply decoded again in order
+    void decodeSpeculatively(size_t chunk, Speculation &speculation, const std::atomic<bool> &cancelled)
+    {
+        ZIPREADER_TIME(Inflate);
+
+        const uint64_t totalBits = static_cast<uint64_t>(input.size()) * 8;
+        const uint64_t from = static_cast<uint64_t>(chunk) * chunkSize * 8;
+        const uint64_t to = std::min<uint64_t>(from + static_cast<uint64_t>(chunkSize) * 8, totalBits);
+
+        for (uint64_t start = from; start < to && !cancelled;)
+        {
+            // The first chunk is the only one whose start is known
+            if (chunk > 0)
+            {
+                start = flate::findBlockStart(input, start, to);
+                if (start >= to)
+                {
+                    return;
+                }
+            }
+
+            try
+            {
+                speculation.chunk = flate::decodeChunk(input, start, to, {}, MaxChunkOutput);
+                speculation.valid = true;
+                return;
+            }
+            catch (const std::exception &)
+            {
+                if (chunk == 0)
+                {
+                    return;
+                }
+                ++start;
+            }
+        }
+    }
+
+    // Replaces the markers from the current window, passes the bytes on and keeps the last 32 KiB
+    void emit(const flate::DecodedChunk &chunk)
+    {
+        const std::span<const uint16_t> symbols = chunk.output();
+        const size_t missing = flate::WindowSize - window.size();
+
+        resolved.resize(symbols.size());
+        for (size_t i = 0; i < symbols.size(); ++i)
+        {
+            const uint16_t symbol = symbols[i];
+
+            if (symbol < flate::WindowMarker)
+            {
+                resolved[i] = static_cast<uint8_t>(symbol);
+                continue;
+            }
+
+            const size_t slot = symbol - flate::WindowMarker;
+            if (slot < missing)
+            {
+                throw std::runtime_error("Back-reference distance too far back");
+            }
+            resolved[i] = window[slot - missing];
+        }
+
+        for (size_t done = 0; done < resolved.size();)
+        {
+            const size_t piece = std::min(resolved.size() - done, Inflater::ChunkSize);
+            {
+                ZIPREADER_TIME(Crc);
+                checksum.update(resolved.data() + done, piece);
+            }
+            {
+                ZIPREADER_TIME(Output);
+                output.write(resolved.data() + done, piece);
+            }
+            ZIPREADER_COUNT(BytesWritten, piece);
+            done += piece;
+        }
+        totalOutput += resolved.size();
+
+        // The next chunk's window is the last 32 KiB of everything so far
+        if (resolved.size() >= flate::WindowSize)
+        {
+            window.assign(resolved.end() - flate::WindowSize, resolved.end());
+        }
+        else
+        {
+            window.insert(window.end(), resolved.begin(), resolved.end());
+            if (window.size() > flate::WindowSize)
+            {
+                window.erase(window.begin(), window.end() - flate::WindowSize);
+            }
+        }
+    }
+
+    std::span<const uint8_t> input;
+    Sink &output;
+    size_t threadCount;
+    size_t chunkSize;
+
+    std::vector<uint8_t> window;
+    std::vector<uint8_t> resolved;
+    Crc32 checksum;
+    uint64_t totalOutput = 0;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <bit>
+#include <type_traits>
+
+// Decoding of fixed-layout little-endian records from descriptors known at compile time.
+// A layout lists where each field of a record sits and how wide it is on the wire; decode()
+// expands into one unaligned load per field straight into the destination struct, which
+// the compiler turns into a handful of moves. Layouts are checked when they are declared:
+// fields in order, none overlapping, all inside the record.
+namespace layout
+{
+    template <typename T>
+    T loadLE(const uint8_t *bytes)
+    {
+        static_assert(std::is_unsigned_v<T>);
+
+        T value;
+        std::memcpy(&value, bytes, sizeof(value));
+
+        if constexpr (std::endian::native == std::endian::big && sizeof(T) > 1)
+        {
+            value = std::byteswap(value);
+        }
+        return value;
+    }
+
+    template <typename Member>
+    struct MemberTraits;
+
+    template <typename Record, typename T>
+    struct MemberTraits<T Record::*>
+    {
+        using RecordType = Record;
+        using ValueType = T;
+    };
+
+    // One field: the member it lands in, its offset in the record and its width on the
+    // wire, which defaults to the member's own and may be narrower (a 32-bit size that is
+    // widened to 64 bits once ZIP64 extra fields are taken into account)
+    template <auto Member, size_t Offset, typename Wire = typename MemberTraits<decltype(Member)>::ValueType>
+    struct Field
+    {
+        using Record = typename MemberTraits<decltype(Member)>::RecordType;
+
+        static constexpr size_t offset = Offset;
+        static constexpr size_t end = Offset + sizeof(Wire);
+
+        static_assert(sizeof(Wire) <= sizeof(typename MemberTraits<decltype(Member)>::ValueType), "Field does not fit its member");
+
+        static void load(Record &record, const uint8_t *bytes)
+        {
+            record.*Member = loadLE<Wire>(bytes + Offset);
+        }
+    };
+
+    template <typename Record, size_t Size, typename... Fields>
+    struct Layout
+    {
+        static constexpr size_t size = Size;
+
+        static Record decode(const uint8_t *bytes)
+        {
+            Record record{};
+            (Fields::load(record, bytes), ...);
+            return record;
+        }
+
+    private:
+        static constexpr bool ordered()
+        {
+            const size_t offsets[] = {Fields::offset...};
+            const size_t ends[] = {Fields::end...};
+
+            for (size_t i = 0; i < sizeof...(Fields); ++i)
+            {
+                if (ends[i] > Size || (i > 0 && offsets[i] < ends[i - 1]))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        static_assert((std::is_same_v<typename Fields::Record, Record> && ...), "Field of another record");
+        static_assert(ordered(), "Fields out of order, overlapping or past the end of the record");
+    };
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdexcept>
+
+#include "CentralDirectoryIndex.hpp"
+#include "Inflate.hpp"
+
+// Access points into one deflated entry, collected by decoding it once. A read of some
+// range later only has to decode from the last point before it instead of from the
+// start. Points cost their 32 KiB window each, the spacing trades that against how much
+// a read may have to decode for nothing. The entry's sizes and CRC tie the index to it.
+class SeekIndex
+{
+public:
+    static constexpr uint64_t DefaultSpacing = uint64_t(4) << 20;
+
+    SeekIndex() = default;
+
+    SeekIndex(const EntryInfo &entry, std::vector<flate::AccessPoint> points)
+        : compressedSize(entry.compressedSize), uncompressedSize(entry.uncompressedSize), crc32(entry.crc32), accessPoints(std::move(points))
+    {
+    }
+
+    bool matches(const EntryInfo &entry) const
+    {
+        return entry.compressedSize == compressedSize && entry.uncompressedSize == uncompressedSize && entry.crc32 == crc32;
+    }
+
+    // The last point at or before offset, nullptr when decoding has to start from the beginning
+    const flate::AccessPoint *closest(uint64_t offset) const
+    {
+        const auto after = std::upper_bound(accessPoints.begin(), accessPoints.end(), offset, [](uint64_t value, const flate::AccessPoint &point)
+                                            { return value < point.output; });
+
+        return after == accessPoints.begin() ? nullptr : &*std::prev(after);
+    }
+
+    const std::vector<flate::AccessPoint> &points() const
+    {
+        return accessPoints;
+    }
+
+    void save(const std::string &path) const
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            throw std::runtime_error("Could not create " + path);
+        }
+
+        file.write(Magic, sizeof(Magic));
+        put(file, ByteOrder);
+        put(file, crc32);
+        put(file, compressedSize);
+        put(file, uncompressedSize);
+        put(file, static_cast<uint64_t>(accessPoints.size()));
+
+        for (const flate::AccessPoint &point : accessPoints)
+        {
+            put(file, point.output);
+            put(file, point.bit);
+            put(file, static_cast<uint32_t>(point.window.size()));
+            file.write(reinterpret_cast<const char *>(point.window.data()), static_cast<std::streamsize>(point.window.size()));
+        }
+
+        if (!file.flush())
+        {
+            throw std::runtime_error("Error writing " + path);
+        }
+    }
+
+    // Nothing when the file is missing or not a seek index this build wrote
+    static std::optional<SeekIndex> load(const std::string &path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        char magic[sizeof(Magic)];
+        uint32_t byteOrder = 0;
+        uint64_t count = 0;
+        SeekIndex index;
+
+        if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, Magic, sizeof(Magic)) != 0 ||
+            !get(file, byteOrder) || byteOrder != ByteOrder || !get(file, index.crc32) ||
+            !get(file, index.compressedSize) || !get(file, index.uncompressedSize) || !get(file, count))
+        {
+            return std::nullopt;
+        }
+
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            flate::AccessPoint point;
+            uint32_t windowSize = 0;
+
+            // Points come in output order and never past the end of the entry
+            if (!get(file, point.output) || !get(file, point.bit) || !get(file, windowSize) || windowSize > flate::WindowSize ||
+                point.output > index.uncompressedSize || (point.bit >> 3) > index.compressedSize ||
+                (!index.accessPoints.empty() && point.output <= index.accessPoints.back().output))
+            {
+                return std::nullopt;
+            }
+
+            point.window.resize(windowSize);
+            if (!file.read(reinterpret_cast<char *>(point.window.data()), windowSize))
+            {
+                return std::nullopt;
+            }
+            index.accessPoints.push_back(std::move(point));
+        }
+
+        return index;
+    }
+
+private:
+    static constexpr char Magic[8] = {'Z', 'R', 'S', 'E', 'E', 'K', '0', '1'};
+    static constexpr uint32_t ByteOrder = 0x01020304;
+
+    template <typename T>
+    static void put(std::ostream &out, T value)
+    {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    static bool get(std::istream &in, T &value)
+    {
+        return static_cast<bool>(in.read(reinterpret_cast<char *>(&value), sizeof(value)));
+    }
+
+    uint64_t compressedSize = 0;
+    uint64_t uncompressedSize = 0;
+    uint32_t crc32 = 0;
+    std::vector<flate::AccessPoint> accessPoints;
+};
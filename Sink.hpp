@@ -0,0 +1,238 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+// Where extracted bytes go. Entries are streamed through write() in chunks of bounded
+// size, so nothing between the archive and the sink ever holds a whole entry.
+class Sink
+{
+public:
+    virtual ~Sink() = default;
+
+    // Called before the first write with the size the central directory announced
+    virtual void begin(uint64_t expectedSize) {}
+
+    virtual void write(const uint8_t *data, size_t size) = 0;
+
+    // Takes length bytes of the source file from offset on without them being handed
+    // through write(), for sinks that can have the kernel copy them. False when the sink
+    // cannot, before anything was taken, and the caller writes them itself.
+    virtual bool copyFrom(int source, uint64_t offset, uint64_t length) { return false; }
+
+    // Called after the last write of an entry that extracted cleanly
+    virtual void finish() {}
+};
+
+// Writes to a file descriptor the caller owns (a file, a pipe, a socket)
+class FdSink : public Sink
+{
+public:
+    explicit FdSink(int descriptor)
+        : fd(descriptor)
+    {
+    }
+
+    void write(const uint8_t *data, size_t size) override
+    {
+        while (size)
+        {
+            const ssize_t written = ::write(fd, data, size);
+
+            if (written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (written <= 0)
+            {
+                throw std::runtime_error(std::string("Error writing output: ") + std::strerror(errno));
+            }
+
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+    }
+
+    // copy_file_range when both ends are files on a filesystem that has it, sendfile for
+    // everything else it takes (pipes and sockets). -DZIPREADER_NO_KERNEL_COPY turns both off.
+    bool copyFrom(int source, uint64_t offset, uint64_t length) override
+    {
+#ifdef ZIPREADER_NO_KERNEL_COPY
+        return false;
+#else
+        // Both calls stop at a little under 2 GiB anyway
+        constexpr uint64_t MaxChunk = uint64_t(1) << 30;
+
+        off_t position = static_cast<off_t>(offset);
+        const uint64_t end = offset + length;
+        bool useSendfile = false;
+
+        while (static_cast<uint64_t>(position) < end)
+        {
+            const size_t chunk = static_cast<size_t>(std::min(end - static_cast<uint64_t>(position), MaxChunk));
+            const bool started = static_cast<uint64_t>(position) != offset;
+
+            const ssize_t copied = useSendfile ? ::sendfile(fd, source, &position, chunk)
+                                               : ::copy_file_range(source, &position, fd, nullptr, chunk, 0);
+
+            if (copied < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (copied < 0 && !started && !useSendfile && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF))
+            {
+                useSendfile = true;
+                continue;
+            }
+
+            if (copied < 0 && !started && (errno == EINVAL || errno == ENOSYS))
+            {
+                return false;
+            }
+
+            if (copied < 0)
+            {
+                throw std::runtime_error(std::string("Error writing output: ") + std::strerror(errno));
+            }
+
+            if (copied == 0)
+            {
+                throw std::runtime_error("Unexpected end of file");
+            }
+        }
+        return true;
+#endif
+    }
+
+    int descriptor() const { return fd; }
+
+private:
+    int fd;
+};
+
+class CallbackSink : public Sink
+{
+public:
+    using Callback = std::function<void(const uint8_t *data, size_t size)>;
+
+    explicit CallbackSink(Callback function)
+        : callback(std::move(function))
+    {
+    }
+
+    void write(const uint8_t *data, size_t size) override
+    {
+        callback(data, size);
+    }
+
+private:
+    Callback callback;
+};
+
+// Hands on only the bytes [skip, skip + length) of everything written to it, for
+// decodes that have to start before the range they are after
+class SliceSink : public Sink
+{
+public:
+    SliceSink(Sink &target, uint64_t skip, uint64_t length)
+        : output(target), skipped(skip), remaining(length)
+    {
+    }
+
+    void write(const uint8_t *data, size_t size) override
+    {
+        const size_t dropped = static_cast<size_t>(std::min<uint64_t>(size, skipped));
+        skipped -= dropped;
+
+        const size_t kept = static_cast<size_t>(std::min<uint64_t>(size - dropped, remaining));
+        if (kept)
+        {
+            output.write(data + dropped, kept);
+            remaining -= kept;
+        }
+    }
+
+    // Nothing more to hand on
+    bool done() const
+    {
+        return remaining == 0;
+    }
+
+private:
+    Sink &output;
+    uint64_t skipped;
+    uint64_t remaining;
+};
+
+// Collects an entry in memory. Either owns a buffer allocated once from the announced
+// size, or fills a caller supplied one; writing past the end is an error in both cases.
+class BufferSink : public Sink
+{
+public:
+    BufferSink() = default;
+
+    explicit BufferSink(std::span<uint8_t> target)
+        : destination(target), external(true)
+    {
+    }
+
+    void begin(uint64_t expectedSize) override
+    {
+        written = 0;
+
+        if (!external)
+        {
+            owned.resize(expectedSize);
+            destination = owned;
+        }
+        else if (expectedSize > destination.size())
+        {
+            throw std::runtime_error("Entry does not fit the supplied buffer");
+        }
+    }
+
+    void write(const uint8_t *data, size_t size) override
+    {
+        if (size > destination.size() - written)
+        {
+            throw std::runtime_error("Entry is larger than its announced size");
+        }
+
+        std::memcpy(destination.data() + written, data, size);
+        written += size;
+    }
+
+    // What was written so far
+    std::span<const uint8_t> bytes() const
+    {
+        return destination.first(written);
+    }
+
+    // Moves the owned buffer out, trimmed to what was written
+    std::vector<uint8_t> release()
+    {
+        owned.resize(written);
+        destination = {};
+        written = 0;
+        return std::move(owned);
+    }
+
+private:
+    std::vector<uint8_t> owned;
+    std::span<uint8_t> destination;
+    bool external = false;
+    size_t written = 0;
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+// Instrumentation, only compiled in with -DZIPREADER_STATS. Without it the macros below
+// expand to nothing and none of this exists in the binary.
+//
+// ZIPREADER_TIME(Phase) charges the rest of the enclosing scope to a phase. Timers nest:
+// while an inner one runs the outer one is paused, so every phase reports exclusive time
+// and the phases add up to the wall time spent inside the library (summed over threads).
+// ZIPREADER_COUNT(Counter, n) adds n to a counter.
+
+#ifdef ZIPREADER_STATS
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <string_view>
+
+namespace stats
+{
+    enum class Phase
+    {
+        Locate,
+        Directory,
+        LocalHeader,
+        Read,
+        Inflate,
+        Crc,
+        Output,
+        Count
+    };
+
+    enum class Counter
+    {
+        BytesRead,
+        ReadCalls,
+        Seeks,
+        BytesWritten,
+        Entries,
+        HuffmanTables,
+        StoredBlocks,
+        FixedBlocks,
+        DynamicBlocks,
+        IndexCacheHits,
+        EntryCacheHits,
+        EntryCacheMisses,
+        Count
+    };
+
+    inline constexpr std::array<std::string_view, size_t(Phase::Count)> phaseNames = {
+        "locate", "directory", "local_header", "read", "inflate", "crc", "output"};
+
+    inline constexpr std::array<std::string_view, size_t(Counter::Count)> counterNames = {
+        "bytes_read", "read_calls", "seeks", "bytes_written", "entries", "huffman_tables",
+        "stored_blocks", "fixed_blocks", "dynamic_blocks", "index_cache_hits", "entry_cache_hits",
+        "entry_cache_misses"};
+
+    struct Registry
+    {
+        std::array<std::atomic<uint64_t>, size_t(Phase::Count)> phaseNanoseconds{};
+        std::array<std::atomic<uint64_t>, size_t(Counter::Count)> counters{};
+    };
+
+    inline Registry &registry()
+    {
+        static Registry instance;
+        return instance;
+    }
+
+    inline void count(Counter counter, uint64_t amount)
+    {
+        registry().counters[size_t(counter)].fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    inline uint64_t value(Counter counter)
+    {
+        return registry().counters[size_t(counter)].load(std::memory_order_relaxed);
+    }
+
+    inline uint64_t nanoseconds(Phase phase)
+    {
+        return registry().phaseNanoseconds[size_t(phase)].load(std::memory_order_relaxed);
+    }
+
+    inline void reset()
+    {
+        for (std::atomic<uint64_t> &phase : registry().phaseNanoseconds)
+        {
+            phase.store(0, std::memory_order_relaxed);
+        }
+        for (std::atomic<uint64_t> &counter : registry().counters)
+        {
+            counter.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    class PhaseTimer
+    {
+    public:
+        explicit PhaseTimer(Phase timed)
+            : phase(timed), parent(current())
+        {
+            const Clock::time_point now = Clock::now();
+
+            if (parent)
+            {
+                parent->charge(now);
+            }
+
+            start = now;
+            current() = this;
+        }
+
+        PhaseTimer(const PhaseTimer &) = delete;
+        PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+        ~PhaseTimer()
+        {
+            const Clock::time_point now = Clock::now();
+
+            charge(now);
+            current() = parent;
+
+            if (parent)
+            {
+                parent->start = now;
+            }
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        static PhaseTimer *&current()
+        {
+            static thread_local PhaseTimer *timer = nullptr;
+            return timer;
+        }
+
+        void charge(Clock::time_point now)
+        {
+            const uint64_t elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+            registry().phaseNanoseconds[size_t(phase)].fetch_add(elapsed, std::memory_order_relaxed);
+            start = now;
+        }
+
+        Phase phase;
+        PhaseTimer *parent;
+        Clock::time_point start;
+    };
+
+    // One JSON object, the archive name escaped as JSON strings require
+    inline void writeJson(std::ostream &os, std::string_view archive)
+    {
+        os << "{\"archive\": \"";
+        for (const char c : archive)
+        {
+            if (c == '"' || c == '\\')
+            {
+                os << '\\' << c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                constexpr char Hex[] = "0123456789abcdef";
+                os << "\\u00" << Hex[static_cast<unsigned char>(c) >> 4] << Hex[c & 0xf];
+            }
+            else
+            {
+                os << c;
+            }
+        }
+
+        os << "\", \"phases_ns\": {";
+        for (size_t i = 0; i < phaseNames.size(); ++i)
+        {
+            os << (i ? ", \"" : "\"") << phaseNames[i] << "\": " << nanoseconds(Phase(i));
+        }
+
+        os << "}, \"counters\": {";
+        for (size_t i = 0; i < counterNames.size(); ++i)
+        {
+            os << (i ? ", \"" : "\"") << counterNames[i] << "\": " << value(Counter(i));
+        }
+        os << "}}\n";
+    }
+}
+
+#define ZIPREADER_STATS_CONCAT2(a, b) a##b
+#define ZIPREADER_STATS_CONCAT(a, b) ZIPREADER_STATS_CONCAT2(a, b)
+#define ZIPREADER_TIME(phase) const ::stats::PhaseTimer ZIPREADER_STATS_CONCAT(phaseTimer, __LINE__)(::stats::Phase::phase)
+#define ZIPREADER_COUNT(counter, amount) ::stats::count(::stats::Counter::counter, (amount))
+
+#else
+
+#define ZIPREADER_TIME(phase)
+#define ZIPREADER_COUNT(counter, amount)
+
+#endif
@@ -0,0 +1,551 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Archive.hpp"
+#include "Crc32.hpp"
+#include "Inflate.hpp"
+#include "InputSource.hpp"
+#include "Sink.hpp"
+#include "Stats.hpp"
+#include "ZipRecords.hpp"
+
+// Buffered, forward only reader over a descriptor that cannot seek (stdin, a pipe, a socket).
+// The last few bytes handed out always stay in the buffer, so whatever a decoder read
+// ahead past the end of its stream can be given back with unread().
+class ForwardStream : public InputSource
+{
+public:
+    static constexpr size_t ChunkSize = 65536;
+    static constexpr size_t KeepBytes = 16;
+
+    // Longest stretch peek() can be asked to make contiguous
+    static constexpr size_t MaxPeek = 64;
+
+    explicit ForwardStream(int descriptor)
+        : fd(descriptor), buffer(KeepBytes + MaxPeek + ChunkSize)
+    {
+    }
+
+    std::span<const uint8_t> next() override
+    {
+        if (position == filled && !fill())
+        {
+            return {};
+        }
+
+        const std::span<const uint8_t> piece(buffer.data() + position, filled - position);
+        consumed += piece.size();
+        position = filled;
+        return piece;
+    }
+
+    // Copies up to count bytes, fewer only at the end of the input
+    size_t read(uint8_t *out, size_t count)
+    {
+        size_t done = 0;
+
+        while (done < count)
+        {
+            if (position == filled && !fill())
+            {
+                break;
+            }
+
+            const size_t available = std::min(count - done, filled - position);
+            std::memcpy(out + done, buffer.data() + position, available);
+            position += available;
+            consumed += available;
+            done += available;
+        }
+
+        return done;
+    }
+
+    // Everything buffered but not consumed yet, at least atLeast bytes unless the input
+    // ends first. Nothing is consumed, call consume() for what was used.
+    std::span<const uint8_t> peek(size_t atLeast)
+    {
+        while (filled - position < atLeast && fill())
+        {
+        }
+
+        return {buffer.data() + position, filled - position};
+    }
+
+    void consume(size_t count)
+    {
+        position += count;
+        consumed += count;
+    }
+
+    void readExact(uint8_t *out, size_t count)
+    {
+        if (read(out, count) != count)
+        {
+            throw std::runtime_error("Unexpected end of archive stream");
+        }
+    }
+
+    void skip(uint64_t count)
+    {
+        uint8_t scratch[4096];
+
+        while (count)
+        {
+            const size_t step = static_cast<size_t>(std::min<uint64_t>(count, sizeof(scratch)));
+            readExact(scratch, step);
+            count -= step;
+        }
+    }
+
+    // Gives back the last count bytes handed out, at most KeepBytes
+    void unread(size_t count)
+    {
+        if (count > position)
+        {
+            throw std::runtime_error("Cannot unread that far back");
+        }
+
+        position -= count;
+        consumed -= count;
+    }
+
+    // Bytes consumed from the start of the input
+    uint64_t offset() const
+    {
+        return consumed;
+    }
+
+private:
+    // Keeps the tail of what was handed out and anything not consumed yet in front of the new data
+    bool fill()
+    {
+        const size_t from = position - std::min(position, KeepBytes);
+        std::memmove(buffer.data(), buffer.data() + from, filled - from);
+        position -= from;
+        filled -= from;
+
+        ZIPREADER_TIME(Read);
+
+        for (;;)
+        {
+            const ssize_t got = ::read(fd, buffer.data() + filled, buffer.size() - filled);
+            ZIPREADER_COUNT(ReadCalls, 1);
+
+            if (got < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (got < 0)
+            {
+                throw std::runtime_error(std::string("Error reading archive stream: ") + std::strerror(errno));
+            }
+
+            ZIPREADER_COUNT(BytesRead, static_cast<uint64_t>(got));
+            filled += static_cast<size_t>(got);
+            return got > 0;
+        }
+    }
+
+    int fd;
+    std::vector<uint8_t> buffer;
+    size_t position = 0;
+    size_t filled = 0;
+    uint64_t consumed = 0;
+};
+
+// One entry as its local header describes it. With bit 3 set the CRC and sizes are
+// only known once the data descriptor after the entry data has been read.
+struct StreamEntry
+{
+    std::string name;
+    uint64_t compressedSize, uncompressedSize;
+    uint32_t crc32;
+    uint16_t flags, method, modTime, modDate;
+    bool zip64;
+
+    bool hasDescriptor() const
+    {
+        return flags & 0x0008;
+    }
+};
+
+// Walks an archive front to back through its local headers without ever seeking, so
+// it can be fed from a pipe while the archive is still arriving. For entries whose sizes
+// are deferred to a data descriptor the decoder itself finds where deflated data ends and
+// the descriptor is read right after it. Stored ones end at the first descriptor whose
+// CRC and sizes match the bytes before it.
+class StreamingReader
+{
+public:
+    explicit StreamingReader(int descriptor)
+        : stream(descriptor)
+    {
+    }
+
+    // Moves to the next entry, skipping what is left of the current one.
+    // False once the central directory or the end of the input is reached.
+    bool next()
+    {
+        if (pending)
+        {
+            CallbackSink discard([](const uint8_t *, size_t) {});
+            extract(discard);
+        }
+
+        constexpr size_t LocalHeaderSize = zip::LocalHeaderLayout::size;
+        uint8_t header[LocalHeaderSize];
+
+        if (stream.read(header, 4) != 4)
+        {
+            return false;
+        }
+
+        uint32_t signature = readLE32(header);
+
+        // Split archive marker some writers put in front of a single part archive
+        if (stream.offset() == 4 && signature == 0x30304b50)
+        {
+            if (stream.read(header, 4) != 4)
+            {
+                return false;
+            }
+            signature = readLE32(header);
+        }
+
+        if (signature == 0x02014b50 || signature == 0x06054b50 || signature == 0x06064b50)
+        {
+            return false;
+        }
+        if (signature != 0x04034b50)
+        {
+            throw std::runtime_error("Bad local file header signature at offset " + std::to_string(stream.offset() - 4));
+        }
+
+        stream.readExact(header + 4, LocalHeaderSize - 4);
+
+        const zip::LocalHeader local = zip::LocalHeaderLayout::decode(header);
+
+        current.flags = local.flags;
+        current.method = local.method;
+        current.modTime = local.modTime;
+        current.modDate = local.modDate;
+        current.crc32 = local.crc32;
+        current.compressedSize = local.compressedSize;
+        current.uncompressedSize = local.uncompressedSize;
+        current.zip64 = false;
+
+        const uint16_t flen = local.nameLength;
+        const uint16_t eFlen = local.extraLength;
+
+        current.name.resize(flen);
+        stream.readExact(reinterpret_cast<uint8_t *>(current.name.data()), flen);
+
+        extra.resize(eFlen);
+        stream.readExact(extra.data(), eFlen);
+        applyLocalZip64(current, extra);
+
+        if (current.hasDescriptor() && current.method != 8 && current.method != 0)
+        {
+            throw std::runtime_error("Cannot find the end of " + current.name + ", method " + std::to_string(current.method) + " without sizes");
+        }
+
+        pending = true;
+        return true;
+    }
+
+    const StreamEntry &entry() const
+    {
+        return current;
+    }
+
+    // Streams the current entry into the sink. False if its method is unsupported or its
+    // CRC does not match, the stream stays usable either way. Corrupt compressed data
+    // throws, there is no way to find the next header after it.
+    bool extract(Sink &sink)
+    {
+        if (!pending)
+        {
+            throw std::runtime_error("No entry to extract");
+        }
+        pending = false;
+
+        ZIPREADER_TIME(LocalHeader);
+        ZIPREADER_COUNT(Entries, 1);
+
+        uint32_t crc = 0;
+        uint64_t compressed = 0, uncompressed = 0;
+
+        if (current.method == 8)
+        {
+            sink.begin(current.hasDescriptor() ? 0 : current.uncompressedSize);
+
+            const uint64_t start = stream.offset();
+
+            ZIPREADER_TIME(Inflate);
+            Inflater inflater(stream, sink);
+            inflater.inflate();
+
+            // Hand back whatever the bit reader pulled in past the final block
+            compressed = inflater.totalIn();
+            stream.unread(static_cast<size_t>(stream.offset() - start - compressed));
+
+            uncompressed = inflater.totalOut();
+            crc = inflater.crc32();
+        }
+        else if (current.method == 0 && current.hasDescriptor())
+        {
+            sink.begin(0);
+
+            uncompressed = compressed = storedUntilDescriptor(sink, crc);
+        }
+        else if (current.method == 0)
+        {
+            sink.begin(current.uncompressedSize);
+
+            Crc32 checksum;
+            uint8_t chunk[16384];
+            uint64_t remaining = current.compressedSize;
+
+            while (remaining)
+            {
+                const size_t step = static_cast<size_t>(std::min<uint64_t>(remaining, sizeof(chunk)));
+                stream.readExact(chunk, step);
+                {
+                    ZIPREADER_TIME(Crc);
+                    checksum.update(chunk, step);
+                }
+                {
+                    ZIPREADER_TIME(Output);
+                    sink.write(chunk, step);
+                }
+                ZIPREADER_COUNT(BytesWritten, step);
+                remaining -= step;
+            }
+
+            compressed = uncompressed = current.compressedSize;
+            crc = checksum.value();
+        }
+        else
+        {
+            std::cerr << "Unsupported compression method " << current.method << " for " << current.name << "\n";
+            stream.skip(current.compressedSize);
+            return false;
+        }
+
+        if (current.hasDescriptor())
+        {
+            readDataDescriptor();
+        }
+
+        if (compressed != current.compressedSize || uncompressed != current.uncompressedSize)
+        {
+            std::cerr << "Size mismatch for " << current.name << "\n";
+            return false;
+        }
+
+        if (crc != current.crc32)
+        {
+            std::cerr << "CRC-32 mismatch for " << current.name << "\n";
+            return false;
+        }
+
+        sink.finish();
+        return true;
+    }
+
+private:
+    // The local copy of the ZIP64 extra field carries both sizes, uncompressed first
+    static void applyLocalZip64(StreamEntry &entry, std::span<const uint8_t> field)
+    {
+        while (field.size() >= 4)
+        {
+            const uint16_t tag = readLE16(field.data());
+            const uint16_t size = readLE16(field.data() + 2);
+
+            if (size > field.size() - 4)
+            {
+                return;
+            }
+
+            if (tag == 0x0001)
+            {
+                entry.zip64 = true;
+
+                const uint8_t *values = field.data() + 4;
+                if (size >= 8 && entry.uncompressedSize == 0xFFFFFFFF)
+                {
+                    entry.uncompressedSize = readLE64(values);
+                }
+                if (size >= 16 && entry.compressedSize == 0xFFFFFFFF)
+                {
+                    entry.compressedSize = readLE64(values + 8);
+                }
+                return;
+            }
+
+            field = field.subspan(4 + size);
+        }
+    }
+
+    // Copies stored data up to the descriptor that describes it, returns its size
+    uint64_t storedUntilDescriptor(Sink &sink, uint32_t &crc)
+    {
+        const size_t descriptorSize = current.zip64 ? 24 : 16;
+
+        Crc32 checksum;
+        uint64_t count = 0;
+
+        for (;;)
+        {
+            const std::span<const uint8_t> data = stream.peek(descriptorSize);
+
+            if (data.size() < descriptorSize)
+            {
+                throw std::runtime_error("Unexpected end of archive stream");
+            }
+
+            // Only the signature is cheap to test, the CRC of the prefix is needed to confirm
+            size_t length = 0;
+            bool found = false;
+
+            for (; length + descriptorSize <= data.size(); ++length)
+            {
+                const uint8_t *candidate = data.data() + length;
+
+                if (candidate[0] != 0x50 || readLE32(candidate) != 0x08074b50)
+                {
+                    continue;
+                }
+
+                const uint64_t size = count + length;
+                const uint64_t compressedField = current.zip64 ? readLE64(candidate + 8) : readLE32(candidate + 8);
+                const uint64_t uncompressedField = current.zip64 ? readLE64(candidate + 16) : readLE32(candidate + 12);
+
+                if (compressedField == size && uncompressedField == size &&
+                    readLE32(candidate + 4) == Crc32::compute(checksum.value(), data.data(), length))
+                {
+                    found = true;
+                    break;
+                }
+            }
+
+            {
+                ZIPREADER_TIME(Crc);
+                checksum.update(data.data(), length);
+            }
+            {
+                ZIPREADER_TIME(Output);
+                sink.write(data.data(), length);
+            }
+            ZIPREADER_COUNT(BytesWritten, length);
+            stream.consume(length);
+            count += length;
+
+            if (found)
+            {
+                crc = checksum.value();
+                return count;
+            }
+        }
+    }
+
+    // crc, compressed and uncompressed size, optionally behind a signature, with 8 byte
+    // sizes when the local header had a ZIP64 field
+    void readDataDescriptor()
+    {
+        uint8_t descriptor[24];
+        const size_t sizeBytes = current.zip64 ? 8 : 4;
+
+        stream.readExact(descriptor, 4);
+
+        if (readLE32(descriptor) == 0x08074b50)
+        {
+            stream.readExact(descriptor, 4);
+        }
+
+        stream.readExact(descriptor + 4, 2 * sizeBytes);
+
+        current.crc32 = readLE32(descriptor);
+        current.compressedSize = current.zip64 ? readLE64(descriptor + 4) : readLE32(descriptor + 4);
+        current.uncompressedSize = current.zip64 ? readLE64(descriptor + 12) : readLE32(descriptor + 8);
+    }
+
+    ForwardStream stream;
+    StreamEntry current;
+    std::vector<uint8_t> extra;
+    bool pending = false;
+};
+
+void extractStreamToDirectory(int descriptor, const std::filesystem::path &directory);
+
+// Unpacks an archive read from descriptor as it arrives, one entry after the other
+inline void extractStreamToDirectory(int descriptor, const std::filesystem::path &directory)
+{
+    StreamingReader reader(descriptor);
+    size_t failures = 0;
+
+    while (reader.next())
+    {
+        const StreamEntry &entry = reader.entry();
+        const std::optional<std::filesystem::path> target = entryTarget(directory, entry.name);
+
+        if (!target)
+        {
+            ++failures;
+            continue;
+        }
+
+        if (!entry.name.empty() && entry.name.back() == '/')
+        {
+            std::filesystem::create_directories(*target);
+            continue;
+        }
+
+        std::filesystem::create_directories(target->parent_path());
+
+        const int fd = ::open(target->c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            std::cerr << "Could not create " << *target << ": " << std::strerror(errno) << "\n";
+            ++failures;
+            continue;
+        }
+
+        FdSink sink(fd);
+        bool extracted = false;
+
+        try
+        {
+            extracted = reader.extract(sink);
+        }
+        catch (...)
+        {
+            ::close(fd);
+            throw;
+        }
+
+        ::close(fd);
+        failures += !extracted;
+    }
+
+    if (failures)
+    {
+        throw std::runtime_error(std::to_string(failures) + " entries could not be extracted");
+    }
+}
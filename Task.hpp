@@ -0,0 +1,170 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace async
+{
+    template <typename T = void>
+    class Task;
+
+    namespace detail
+    {
+        // A finished task hands control straight to whoever awaited it, through symmetric
+        // transfer, so a long chain of tasks completing one after the other never nests
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept { return false; }
+
+            template <typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) noexcept
+            {
+                const std::coroutine_handle<> next = finished.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        struct PromiseBase
+        {
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            FinalAwaiter final_suspend() noexcept { return {}; }
+
+            void unhandled_exception()
+            {
+                error = std::current_exception();
+            }
+
+            std::coroutine_handle<> continuation;
+            std::exception_ptr error;
+        };
+
+        template <typename T>
+        struct Promise : PromiseBase
+        {
+            void return_value(T result)
+            {
+                value.emplace(std::move(result));
+            }
+
+            T take()
+            {
+                if (error)
+                {
+                    std::rethrow_exception(error);
+                }
+                return std::move(*value);
+            }
+
+            std::optional<T> value;
+        };
+
+        template <>
+        struct Promise<void> : PromiseBase
+        {
+            void return_void() {}
+
+            void take()
+            {
+                if (error)
+                {
+                    std::rethrow_exception(error);
+                }
+            }
+        };
+    }
+
+    // Coroutine returning a T. Nothing runs until the task is awaited (or started by
+    // whoever drives it, see blockOn), it then runs on that thread up to its first
+    // suspension. Exceptions travel to the awaiter. The task owns its frame.
+    template <typename T>
+    class Task
+    {
+    public:
+        struct promise_type : detail::Promise<T>
+        {
+            Task get_return_object()
+            {
+                return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+        };
+
+        Task() = default;
+
+        Task(Task &&other) noexcept
+            : handle(std::exchange(other.handle, {}))
+        {
+        }
+
+        Task &operator=(Task &&other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                handle = std::exchange(other.handle, {});
+            }
+            return *this;
+        }
+
+        Task(const Task &) = delete;
+        Task &operator=(const Task &) = delete;
+
+        ~Task()
+        {
+            reset();
+        }
+
+        bool await_ready() const noexcept
+        {
+            return !handle || handle.done();
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            handle.promise().continuation = awaiting;
+            return handle;
+        }
+
+        T await_resume()
+        {
+            return handle.promise().take();
+        }
+
+        // For drivers that do not await: runs the task up to its first suspension
+        void start()
+        {
+            handle.resume();
+        }
+
+        bool done() const
+        {
+            return !handle || handle.done();
+        }
+
+        // The value, or the exception the task ended with. Only once done().
+        T result()
+        {
+            return handle.promise().take();
+        }
+
+    private:
+        explicit Task(std::coroutine_handle<promise_type> coroutine)
+            : handle(coroutine)
+        {
+        }
+
+        void reset()
+        {
+            if (handle)
+            {
+                handle.destroy();
+                handle = {};
+            }
+        }
+
+        std::coroutine_handle<promise_type> handle;
+    };
+}
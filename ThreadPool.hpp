@@ -0,0 +1,212 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work stealing pool. Every worker owns a deque, takes its own work from the back and
+// steals from the front of the others once it runs dry, so a few huge tasks mixed with
+// many tiny ones still keep every thread busy.
+class ThreadPool
+{
+public:
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency())
+    {
+        if (threads == 0)
+        {
+            threads = 1;
+        }
+
+        for (size_t i = 0; i < threads; ++i)
+        {
+            queues.push_back(std::make_unique<Queue>());
+        }
+
+        for (size_t i = 0; i < threads; ++i)
+        {
+            workers.emplace_back([this, i]
+                                 { workerLoop(i); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    // Tasks submitted from a worker stay on that worker's deque, the rest are dealt round robin
+    void submit(Task task)
+    {
+        const WorkerIdentity &worker = currentWorker();
+        const size_t target = worker.pool == this ? worker.index : nextQueue++ % queues.size();
+
+        pending.fetch_add(1);
+
+        // Counted before it is queued so no worker takes it uncounted, a worker that finds
+        // nothing in the meantime just looks again
+        queued.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(queues[target]->mutex);
+            queues[target]->tasks.push_back(std::move(task));
+        }
+
+        // A worker about to sleep registers first and then checks queued, so either it sees
+        // this task or we see it. The lock makes sure it is really waiting when notified.
+        if (sleepers.load() > 0)
+        {
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+            }
+            wake.notify_one();
+        }
+    }
+
+    // Blocks until every submitted task finished, rethrows the first exception a task threw
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        done.wait(lock, [this]
+                  { return pending.load() == 0; });
+
+        if (firstError)
+        {
+            std::exception_ptr error = firstError;
+            firstError = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    size_t size() const
+    {
+        return workers.size();
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    struct WorkerIdentity
+    {
+        const ThreadPool *pool = nullptr;
+        size_t index = 0;
+    };
+
+    static WorkerIdentity &currentWorker()
+    {
+        static thread_local WorkerIdentity identity;
+        return identity;
+    }
+
+    bool takeTask(size_t self, Task &task)
+    {
+        {
+            Queue &own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < queues.size(); ++i)
+        {
+            Queue &victim = *queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void workerLoop(size_t self)
+    {
+        currentWorker() = {this, self};
+
+        for (;;)
+        {
+            Task task;
+
+            if (takeTask(self, task))
+            {
+                queued.fetch_sub(1);
+
+                try
+                {
+                    task();
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(sleepMutex);
+                    if (!firstError)
+                    {
+                        firstError = std::current_exception();
+                    }
+                }
+
+                if (pending.fetch_sub(1) == 1)
+                {
+                    std::lock_guard<std::mutex> lock(sleepMutex);
+                    done.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepers.fetch_add(1);
+            wake.wait(lock, [this]
+                      { return stopping || queued.load() > 0; });
+            sleepers.fetch_sub(1);
+
+            if (stopping && queued.load() == 0)
+            {
+                return;
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    // Only for workers going to sleep and waking up, queueing work never takes it unless
+    // someone sleeps
+    std::mutex sleepMutex;
+    std::condition_variable wake, done;
+    bool stopping = false;
+    std::exception_ptr firstError;
+
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> sleepers{0};
+    std::atomic<size_t> pending{0};
+    std::atomic<size_t> nextQueue{0};
+};
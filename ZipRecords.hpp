@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "RecordLayout.hpp"
+
+// The fixed parts of the ZIP records we read, as decoded structs and their on-disk layouts
+// (APPNOTE 4.3). Sizes and offsets that ZIP64 may replace are 64 bits wide in the structs
+// and loaded from their 32 or 16-bit slots.
+namespace zip
+{
+    using layout::Field;
+    using layout::Layout;
+
+    struct LocalHeader
+    {
+        static constexpr uint32_t Signature = 0x04034b50;
+
+        uint32_t signature;
+        uint16_t versionNeeded, flags, method, modTime, modDate;
+        uint32_t crc32;
+        uint64_t compressedSize, uncompressedSize;
+        uint16_t nameLength, extraLength;
+    };
+
+    using LocalHeaderLayout = Layout<LocalHeader, 30,
+                                     Field<&LocalHeader::signature, 0>,
+                                     Field<&LocalHeader::versionNeeded, 4>,
+                                     Field<&LocalHeader::flags, 6>,
+                                     Field<&LocalHeader::method, 8>,
+                                     Field<&LocalHeader::modTime, 10>,
+                                     Field<&LocalHeader::modDate, 12>,
+                                     Field<&LocalHeader::crc32, 14>,
+                                     Field<&LocalHeader::compressedSize, 18, uint32_t>,
+                                     Field<&LocalHeader::uncompressedSize, 22, uint32_t>,
+                                     Field<&LocalHeader::nameLength, 26>,
+                                     Field<&LocalHeader::extraLength, 28>>;
+
+    struct CentralHeader
+    {
+        static constexpr uint32_t Signature = 0x02014b50;
+
+        uint32_t signature;
+        uint16_t versionMadeBy, versionNeeded, flags, method, modTime, modDate;
+        uint32_t crc32;
+        uint64_t compressedSize, uncompressedSize;
+        uint16_t nameLength, extraLength, commentLength;
+        uint32_t diskStart;
+        uint16_t internalAttributes;
+        uint32_t externalAttributes;
+        uint64_t localHeaderOffset;
+    };
+
+    using CentralHeaderLayout = Layout<CentralHeader, 46,
+                                       Field<&CentralHeader::signature, 0>,
+                                       Field<&CentralHeader::versionMadeBy, 4>,
+                                       Field<&CentralHeader::versionNeeded, 6>,
+                                       Field<&CentralHeader::flags, 8>,
+                                       Field<&CentralHeader::method, 10>,
+                                       Field<&CentralHeader::modTime, 12>,
+                                       Field<&CentralHeader::modDate, 14>,
+                                       Field<&CentralHeader::crc32, 16>,
+                                       Field<&CentralHeader::compressedSize, 20, uint32_t>,
+                                       Field<&CentralHeader::uncompressedSize, 24, uint32_t>,
+                                       Field<&CentralHeader::nameLength, 28>,
+                                       Field<&CentralHeader::extraLength, 30>,
+                                       Field<&CentralHeader::commentLength, 32>,
+                                       Field<&CentralHeader::diskStart, 34, uint16_t>,
+                                       Field<&CentralHeader::internalAttributes, 36>,
+                                       Field<&CentralHeader::externalAttributes, 38>,
+                                       Field<&CentralHeader::localHeaderOffset, 42, uint32_t>>;
+
+    struct EndOfCentralDirectory
+    {
+        static constexpr uint32_t Signature = 0x06054b50;
+
+        uint32_t signature;
+        uint16_t diskNumber, directoryDisk;
+        uint64_t entriesOnDisk, entries, directorySize, directoryOffset;
+        uint16_t commentLength;
+    };
+
+    using EndOfCentralDirectoryLayout = Layout<EndOfCentralDirectory, 22,
+                                               Field<&EndOfCentralDirectory::signature, 0>,
+                                               Field<&EndOfCentralDirectory::diskNumber, 4>,
+                                               Field<&EndOfCentralDirectory::directoryDisk, 6>,
+                                               Field<&EndOfCentralDirectory::entriesOnDisk, 8, uint16_t>,
+                                               Field<&EndOfCentralDirectory::entries, 10, uint16_t>,
+                                               Field<&EndOfCentralDirectory::directorySize, 12, uint32_t>,
+                                               Field<&EndOfCentralDirectory::directoryOffset, 16, uint32_t>,
+                                               Field<&EndOfCentralDirectory::commentLength, 20>>;
+
+    struct Zip64Locator
+    {
+        static constexpr uint32_t Signature = 0x07064b50;
+
+        uint32_t signature, directoryDisk;
+        uint64_t endOffset;
+        uint32_t diskCount;
+    };
+
+    using Zip64LocatorLayout = Layout<Zip64Locator, 20,
+                                      Field<&Zip64Locator::signature, 0>,
+                                      Field<&Zip64Locator::directoryDisk, 4>,
+                                      Field<&Zip64Locator::endOffset, 8>,
+                                      Field<&Zip64Locator::diskCount, 16>>;
+
+    struct Zip64EndOfCentralDirectory
+    {
+        static constexpr uint32_t Signature = 0x06064b50;
+
+        uint32_t signature;
+        uint64_t recordSize;
+        uint16_t versionMadeBy, versionNeeded;
+        uint32_t diskNumber, directoryDisk;
+        uint64_t entriesOnDisk, entries, directorySize, directoryOffset;
+    };
+
+    using Zip64EndOfCentralDirectoryLayout = Layout<Zip64EndOfCentralDirectory, 56,
+                                                    Field<&Zip64EndOfCentralDirectory::signature, 0>,
+                                                    Field<&Zip64EndOfCentralDirectory::recordSize, 4>,
+                                                    Field<&Zip64EndOfCentralDirectory::versionMadeBy, 12>,
+                                                    Field<&Zip64EndOfCentralDirectory::versionNeeded, 14>,
+                                                    Field<&Zip64EndOfCentralDirectory::diskNumber, 16>,
+                                                    Field<&Zip64EndOfCentralDirectory::directoryDisk, 20>,
+                                                    Field<&Zip64EndOfCentralDirectory::entriesOnDisk, 24>,
+                                                    Field<&Zip64EndOfCentralDirectory::entries, 32>,
+                                                    Field<&Zip64EndOfCentralDirectory::directorySize, 40>,
+                                                    Field<&Zip64EndOfCentralDirectory::directoryOffset, 48>>;
+}
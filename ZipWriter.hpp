@@ -0,0 +1,415 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "BitWriter.hpp"
+#include "Crc32.hpp"
+#include "Deflate.hpp"
+#include "Sink.hpp"
+#include "ThreadPool.hpp"
+
+// Writes a zip archive into a sink. Entries are compressed on a thread pool, large ones
+// split into pieces that compress concurrently and join into one deflate stream, and are
+// written out in the order they were added as soon as everything before them is done.
+// Sizes are known before a local header is written, so no data descriptors are needed;
+// ZIP64 records appear only where a size, offset or the entry count overflows.
+class ZipWriter
+{
+public:
+    // add() blocks while this much input is waiting to be compressed and written
+    static constexpr size_t MaxPendingBytes = size_t(256) << 20;
+
+    explicit ZipWriter(Sink &sink, int level = 6, size_t threads = std::thread::hardware_concurrency())
+        : output(sink), compressionLevel(level), pool(threads)
+    {
+    }
+
+    ZipWriter(const ZipWriter &) = delete;
+    ZipWriter &operator=(const ZipWriter &) = delete;
+
+    void add(std::string name, std::vector<uint8_t> data, std::time_t modified = std::time(nullptr))
+    {
+        checkName(name);
+
+        auto entry = std::make_unique<Pending>();
+        Pending &pending = *entry;
+
+        pending.name = std::move(name);
+        pending.data = std::move(data);
+        toDosDateTime(modified, pending.modTime, pending.modDate);
+
+        const size_t size = pending.data.size();
+        const size_t pieces = std::max<size_t>(1, (size + flate::CompressChunkSize - 1) / flate::CompressChunkSize);
+
+        pending.pieces.resize(pieces);
+        pending.crcs.resize(pieces);
+        pending.remaining = pieces;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            room.wait(lock, [this]
+                      { return pendingBytes < MaxPendingBytes || queue.empty() || failed; });
+
+            if (failed)
+            {
+                lock.unlock();
+                pool.wait();
+                throw std::runtime_error("Writing the archive failed");
+            }
+
+            pendingBytes += size;
+            queue.push_back(std::move(entry));
+        }
+
+        for (size_t i = 0; i < pieces; ++i)
+        {
+            pool.submit([this, &pending, i]
+                        { compressPiece(pending, i); });
+        }
+    }
+
+    void addDirectory(std::string name, std::time_t modified = std::time(nullptr))
+    {
+        if (name.empty() || name.back() != '/')
+        {
+            name += '/';
+        }
+        checkName(name);
+
+        auto entry = std::make_unique<Pending>();
+        entry->name = std::move(name);
+        entry->directory = true;
+        toDosDateTime(modified, entry->modTime, entry->modDate);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        entry->ready = true;
+        queue.push_back(std::move(entry));
+        writeReady();
+    }
+
+    // Waits for every entry, then writes the central directory and the end records
+    void finish()
+    {
+        pool.wait();
+
+        if (!queue.empty())
+        {
+            throw std::runtime_error("Entries were left unwritten");
+        }
+
+        const uint64_t directoryOffset = written;
+        std::vector<uint8_t> header;
+
+        for (const Record &record : records)
+        {
+            const bool bigSize = record.uncompressedSize >= 0xFFFFFFFF || record.compressedSize >= 0xFFFFFFFF;
+            const bool bigOffset = record.offset >= 0xFFFFFFFF;
+
+            std::vector<uint8_t> extra;
+            if (bigSize || bigOffset)
+            {
+                append16(extra, 0x0001);
+                append16(extra, static_cast<uint16_t>((bigSize ? 16 : 0) + (bigOffset ? 8 : 0)));
+                if (bigSize)
+                {
+                    append64(extra, record.uncompressedSize);
+                    append64(extra, record.compressedSize);
+                }
+                if (bigOffset)
+                {
+                    append64(extra, record.offset);
+                }
+            }
+
+            header.clear();
+            append32(header, 0x02014b50);
+            append16(header, 3 << 8 | 45);
+            append16(header, bigSize || bigOffset ? 45 : 20);
+            append16(header, 0x0800);
+            append16(header, record.method);
+            append16(header, record.modTime);
+            append16(header, record.modDate);
+            append32(header, record.crc);
+            append32(header, bigSize ? 0xFFFFFFFF : static_cast<uint32_t>(record.compressedSize));
+            append32(header, bigSize ? 0xFFFFFFFF : static_cast<uint32_t>(record.uncompressedSize));
+            append16(header, static_cast<uint16_t>(record.name.size()));
+            append16(header, static_cast<uint16_t>(extra.size()));
+            append16(header, 0);
+            append16(header, 0);
+            append16(header, 0);
+            // Unix permissions in the high half, the MS-DOS directory bit in the low one
+            append32(header, record.directory ? (040755u << 16 | 0x10) : 0100644u << 16);
+            append32(header, bigOffset ? 0xFFFFFFFF : static_cast<uint32_t>(record.offset));
+            header.insert(header.end(), record.name.begin(), record.name.end());
+            header.insert(header.end(), extra.begin(), extra.end());
+
+            emit(header.data(), header.size());
+        }
+
+        const uint64_t directorySize = written - directoryOffset;
+        const uint64_t count = records.size();
+
+        header.clear();
+
+        if (count >= 0xFFFF || directorySize >= 0xFFFFFFFF || directoryOffset >= 0xFFFFFFFF)
+        {
+            const uint64_t zip64Offset = written;
+
+            append32(header, 0x06064b50);
+            append64(header, 44);
+            append16(header, 3 << 8 | 45);
+            append16(header, 45);
+            append32(header, 0);
+            append32(header, 0);
+            append64(header, count);
+            append64(header, count);
+            append64(header, directorySize);
+            append64(header, directoryOffset);
+
+            append32(header, 0x07064b50);
+            append32(header, 0);
+            append64(header, zip64Offset);
+            append32(header, 1);
+        }
+
+        append32(header, 0x06054b50);
+        append16(header, 0);
+        append16(header, 0);
+        append16(header, static_cast<uint16_t>(std::min<uint64_t>(count, 0xFFFF)));
+        append16(header, static_cast<uint16_t>(std::min<uint64_t>(count, 0xFFFF)));
+        append32(header, static_cast<uint32_t>(std::min<uint64_t>(directorySize, 0xFFFFFFFF)));
+        append32(header, static_cast<uint32_t>(std::min<uint64_t>(directoryOffset, 0xFFFFFFFF)));
+        append16(header, 0);
+
+        emit(header.data(), header.size());
+        output.finish();
+    }
+
+    uint64_t bytesWritten() const
+    {
+        return written;
+    }
+
+private:
+    struct Pending
+    {
+        std::string name;
+        std::vector<uint8_t> data;
+        uint16_t modTime = 0, modDate = 0;
+        bool directory = false;
+
+        std::vector<std::vector<uint8_t>> pieces;
+        std::vector<uint32_t> crcs;
+        std::atomic<size_t> remaining{0};
+
+        std::vector<uint8_t> compressed;
+        uint32_t crc = 0;
+        uint16_t method = 0;
+        bool ready = false;
+    };
+
+    // What the central directory needs once the entry itself is gone
+    struct Record
+    {
+        std::string name;
+        uint64_t compressedSize, uncompressedSize, offset;
+        uint32_t crc;
+        uint16_t method, modTime, modDate;
+        bool directory;
+    };
+
+    static void append16(std::vector<uint8_t> &to, uint16_t value)
+    {
+        to.push_back(static_cast<uint8_t>(value));
+        to.push_back(static_cast<uint8_t>(value >> 8));
+    }
+
+    static void append32(std::vector<uint8_t> &to, uint32_t value)
+    {
+        append16(to, static_cast<uint16_t>(value));
+        append16(to, static_cast<uint16_t>(value >> 16));
+    }
+
+    static void append64(std::vector<uint8_t> &to, uint64_t value)
+    {
+        append32(to, static_cast<uint32_t>(value));
+        append32(to, static_cast<uint32_t>(value >> 32));
+    }
+
+    static void checkName(const std::string &name)
+    {
+        if (name.empty() || name.size() > 0xFFFF)
+        {
+            throw std::runtime_error("Entry names must be 1 to 65535 bytes long");
+        }
+    }
+
+    // MS-DOS timestamps are local time with two second resolution and start in 1980
+    static void toDosDateTime(std::time_t time, uint16_t &dosTime, uint16_t &dosDate)
+    {
+        std::tm local{};
+        localtime_r(&time, &local);
+
+        if (local.tm_year < 80)
+        {
+            dosTime = 0;
+            dosDate = (1 << 5) | 1;
+            return;
+        }
+
+        dosTime = static_cast<uint16_t>(local.tm_hour << 11 | local.tm_min << 5 | local.tm_sec / 2);
+        dosDate = static_cast<uint16_t>((local.tm_year - 80) << 9 | (local.tm_mon + 1) << 5 | local.tm_mday);
+    }
+
+    void compressPiece(Pending &entry, size_t index)
+    {
+        const size_t offset = index * flate::CompressChunkSize;
+        const size_t length = std::min(entry.data.size() - offset, flate::CompressChunkSize);
+        const uint8_t *data = entry.data.data() + offset;
+
+        entry.crcs[index] = Crc32::compute(0, data, length);
+
+        if (compressionLevel > 0)
+        {
+            Deflater deflater(compressionLevel);
+            BitWriter out;
+            deflater.compress(data, length, std::min(offset, flate::WindowSize), index + 1 == entry.pieces.size(), out);
+            entry.pieces[index] = out.release();
+        }
+
+        if (entry.remaining.fetch_sub(1) != 1)
+        {
+            return;
+        }
+
+        // Last piece done, join them. Entries that did not shrink are stored instead.
+        entry.crc = entry.crcs[0];
+        for (size_t i = 1; i < entry.crcs.size(); ++i)
+        {
+            const size_t pieceLength = std::min(entry.data.size() - i * flate::CompressChunkSize, flate::CompressChunkSize);
+            entry.crc = Crc32::combine(entry.crc, entry.crcs[i], pieceLength);
+        }
+
+        size_t compressedSize = 0;
+        for (const std::vector<uint8_t> &piece : entry.pieces)
+        {
+            compressedSize += piece.size();
+        }
+
+        if (compressionLevel > 0 && compressedSize < entry.data.size())
+        {
+            entry.compressed.reserve(compressedSize);
+            for (std::vector<uint8_t> &piece : entry.pieces)
+            {
+                entry.compressed.insert(entry.compressed.end(), piece.begin(), piece.end());
+                std::vector<uint8_t>().swap(piece);
+            }
+            entry.method = 8;
+        }
+        entry.pieces.clear();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        entry.ready = true;
+        writeReady();
+    }
+
+    // Writes every finished entry at the front of the queue, call with the mutex held
+    void writeReady()
+    {
+        try
+        {
+            while (!queue.empty() && queue.front()->ready)
+            {
+                Pending &entry = *queue.front();
+                writeEntry(entry);
+                pendingBytes -= entry.data.size();
+                queue.pop_front();
+            }
+        }
+        catch (...)
+        {
+            failed = true;
+            room.notify_all();
+            throw;
+        }
+
+        room.notify_all();
+    }
+
+    void writeEntry(const Pending &entry)
+    {
+        const std::vector<uint8_t> &body = entry.method == 8 ? entry.compressed : entry.data;
+        const uint64_t uncompressedSize = entry.data.size();
+        const uint64_t compressedSize = body.size();
+        const bool zip64 = uncompressedSize >= 0xFFFFFFFF || compressedSize >= 0xFFFFFFFF;
+
+        std::vector<uint8_t> header;
+        append32(header, 0x04034b50);
+        append16(header, zip64 ? 45 : 20);
+        append16(header, 0x0800);
+        append16(header, entry.method);
+        append16(header, entry.modTime);
+        append16(header, entry.modDate);
+        append32(header, entry.crc);
+        append32(header, zip64 ? 0xFFFFFFFF : static_cast<uint32_t>(compressedSize));
+        append32(header, zip64 ? 0xFFFFFFFF : static_cast<uint32_t>(uncompressedSize));
+        append16(header, static_cast<uint16_t>(entry.name.size()));
+        append16(header, zip64 ? 20 : 0);
+        header.insert(header.end(), entry.name.begin(), entry.name.end());
+
+        if (zip64)
+        {
+            append16(header, 0x0001);
+            append16(header, 16);
+            append64(header, uncompressedSize);
+            append64(header, compressedSize);
+        }
+
+        records.push_back({entry.name, compressedSize, uncompressedSize, written, entry.crc,
+                           entry.method, entry.modTime, entry.modDate, entry.directory});
+
+        emit(header.data(), header.size());
+        emit(body.data(), body.size());
+    }
+
+    void emit(const uint8_t *data, size_t size)
+    {
+        // Sinks take bounded chunks, an entry can be far larger than that
+        while (size)
+        {
+            const size_t chunk = std::min<size_t>(size, size_t(1) << 20);
+            output.write(data, chunk);
+            data += chunk;
+            size -= chunk;
+            written += chunk;
+        }
+    }
+
+    Sink &output;
+    int compressionLevel;
+
+    std::mutex mutex;
+    std::condition_variable room;
+    std::deque<std::unique_ptr<Pending>> queue;
+    size_t pendingBytes = 0;
+    bool failed = false;
+
+    std::vector<Record> records;
+    uint64_t written = 0;
+
+    // Last, so its workers are joined before anything they use goes away
+    ThreadPool pool;
+};
@@ -0,0 +1,441 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+
+#include "Archive.hpp"
+#include "EntryCache.hpp"
+
+// zlib is only the yardstick (and the compressor for the corpus), build with -lz.
+// Without it deflated corpus entries are made of stored deflate blocks.
+#if __has_include(<zlib.h>) && !defined(ZIPREADER_NO_ZLIB)
+#include <zlib.h>
+#define ZIPREADER_BENCH_ZLIB 1
+#endif
+
+// bench [corpus directory] [scale]
+// Generates the corpus once (scale 1 is roughly 150 MB of entry data) and reports
+// central directory entries/s, EOCD locate latency, inflate and CRC-32 throughput, and
+// what the entry cache saves on entries that are read over and over.
+
+struct CorpusEntry
+{
+    std::string name;
+    std::vector<uint8_t> data;
+    bool store;
+};
+
+uint64_t nextRandom(uint64_t &state);
+std::vector<uint8_t> randomBytes(size_t size, uint64_t seed);
+std::vector<uint8_t> textBytes(size_t size, uint64_t seed);
+std::vector<uint8_t> deflateBytes(const std::vector<uint8_t> &data);
+void writeArchive(const std::filesystem::path &path, const std::vector<CorpusEntry> &entries);
+void generateCorpus(const std::filesystem::path &directory, size_t scale);
+double bestOf(int runs, const std::function<void()> &work);
+void report(std::string_view what, double value, std::string_view unit);
+void benchArchive(const std::filesystem::path &path);
+void benchInflate(std::string_view what, const std::vector<uint8_t> &data);
+void benchCrc(const std::vector<uint8_t> &data);
+void benchEntryCache(const std::filesystem::path &path);
+
+// xorshift64*, deterministic so every run measures the same corpus
+uint64_t nextRandom(uint64_t &state)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ull;
+}
+
+std::vector<uint8_t> randomBytes(size_t size, uint64_t seed)
+{
+    std::vector<uint8_t> bytes(size);
+    uint64_t state = seed | 1;
+
+    for (size_t i = 0; i < size; i += 8)
+    {
+        const uint64_t value = nextRandom(state);
+        std::memcpy(bytes.data() + i, &value, std::min<size_t>(8, size - i));
+    }
+    return bytes;
+}
+
+// Words from a small vocabulary, compresses about as well as markup does
+std::vector<uint8_t> textBytes(size_t size, uint64_t seed)
+{
+    static constexpr std::string_view words[] = {
+        "<w:r>", "<w:t>", "</w:t>", "</w:r>", "the", "central", "directory", "entry",
+        "archive", "stream", "header", "of", "and", "a", "to", "in", "deflate", "block",
+        "\n", "  ", "w:val=\"", "\"/>", "0", "1", "2", "42", "1024", "lorem", "ipsum"};
+
+    std::vector<uint8_t> bytes;
+    bytes.reserve(size + 16);
+    uint64_t state = seed | 1;
+
+    while (bytes.size() < size)
+    {
+        const std::string_view word = words[nextRandom(state) % std::size(words)];
+        bytes.insert(bytes.end(), word.begin(), word.end());
+        bytes.push_back(' ');
+    }
+
+    bytes.resize(size);
+    return bytes;
+}
+
+// Raw deflate, no zlib header
+std::vector<uint8_t> deflateBytes(const std::vector<uint8_t> &data)
+{
+#ifdef ZIPREADER_BENCH_ZLIB
+    z_stream stream{};
+    if (deflateInit2(&stream, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        throw std::runtime_error("deflateInit2 failed");
+    }
+
+    std::vector<uint8_t> out(deflateBound(&stream, data.size()));
+    stream.next_in = const_cast<Bytef *>(data.data());
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = out.data();
+    stream.avail_out = static_cast<uInt>(out.size());
+
+    const int result = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+
+    if (result != Z_STREAM_END)
+    {
+        throw std::runtime_error("deflate failed");
+    }
+
+    out.resize(stream.total_out);
+    return out;
+#else
+    std::vector<uint8_t> out;
+    size_t done = 0;
+
+    do
+    {
+        const size_t length = std::min<size_t>(data.size() - done, 65535);
+        const bool final = done + length == data.size();
+
+        out.push_back(final ? 1 : 0);
+        out.push_back(static_cast<uint8_t>(length));
+        out.push_back(static_cast<uint8_t>(length >> 8));
+        out.push_back(static_cast<uint8_t>(~length));
+        out.push_back(static_cast<uint8_t>(~length >> 8));
+        out.insert(out.end(), data.begin() + done, data.begin() + done + length);
+        done += length;
+    } while (done < data.size());
+
+    return out;
+#endif
+}
+
+void writeArchive(const std::filesystem::path &path, const std::vector<CorpusEntry> &entries)
+{
+    std::ofstream out(path, std::ios::binary);
+    std::vector<uint8_t> central;
+
+    auto put16 = [](std::vector<uint8_t> &to, uint16_t value)
+    {
+        to.push_back(static_cast<uint8_t>(value));
+        to.push_back(static_cast<uint8_t>(value >> 8));
+    };
+    auto put32 = [&put16](std::vector<uint8_t> &to, uint32_t value)
+    {
+        put16(to, static_cast<uint16_t>(value));
+        put16(to, static_cast<uint16_t>(value >> 16));
+    };
+
+    uint32_t offset = 0;
+
+    for (const CorpusEntry &entry : entries)
+    {
+        const std::vector<uint8_t> compressed = entry.store ? entry.data : deflateBytes(entry.data);
+        const uint32_t crc = Crc32::compute(0, entry.data.data(), entry.data.size());
+        const uint16_t method = entry.store ? 0 : 8;
+
+        std::vector<uint8_t> local;
+        put32(local, 0x04034b50);
+        put16(local, 20);
+        put16(local, 0);
+        put16(local, method);
+        put32(local, 0x00210000);
+        put32(local, crc);
+        put32(local, static_cast<uint32_t>(compressed.size()));
+        put32(local, static_cast<uint32_t>(entry.data.size()));
+        put16(local, static_cast<uint16_t>(entry.name.size()));
+        put16(local, 0);
+        local.insert(local.end(), entry.name.begin(), entry.name.end());
+
+        put32(central, 0x02014b50);
+        put16(central, 20);
+        central.insert(central.end(), local.begin() + 4, local.begin() + 30);
+        put16(central, 0);
+        put16(central, 0);
+        put16(central, 0);
+        put32(central, 0);
+        put32(central, offset);
+        central.insert(central.end(), entry.name.begin(), entry.name.end());
+
+        out.write(reinterpret_cast<const char *>(local.data()), static_cast<std::streamsize>(local.size()));
+        out.write(reinterpret_cast<const char *>(compressed.data()), static_cast<std::streamsize>(compressed.size()));
+        offset += static_cast<uint32_t>(local.size() + compressed.size());
+    }
+
+    std::vector<uint8_t> eocd;
+    put32(eocd, 0x06054b50);
+    put32(eocd, 0);
+    put16(eocd, static_cast<uint16_t>(entries.size()));
+    put16(eocd, static_cast<uint16_t>(entries.size()));
+    put32(eocd, static_cast<uint32_t>(central.size()));
+    put32(eocd, offset);
+    put16(eocd, 0);
+
+    out.write(reinterpret_cast<const char *>(central.data()), static_cast<std::streamsize>(central.size()));
+    out.write(reinterpret_cast<const char *>(eocd.data()), static_cast<std::streamsize>(eocd.size()));
+
+    if (!out)
+    {
+        throw std::runtime_error("Could not write " + path.string());
+    }
+}
+
+void generateCorpus(const std::filesystem::path &directory, size_t scale)
+{
+    std::filesystem::create_directories(directory);
+    const size_t mb = size_t(1) << 20;
+
+    auto build = [&directory](const char *name, const std::function<std::vector<CorpusEntry>()> &make)
+    {
+        const std::filesystem::path path = directory / name;
+        if (!std::filesystem::exists(path))
+        {
+            std::cerr << "generating " << path.string() << "\n";
+            writeArchive(path, make());
+        }
+    };
+
+    build("tiny.zip", [scale]
+          {
+        std::vector<CorpusEntry> entries;
+        for (size_t i = 0; i < 20000 * scale; ++i)
+        {
+            entries.push_back({"tiny/" + std::to_string(i) + ".xml", textBytes(64 + i % 1024, i + 1), i % 4 == 0});
+        }
+        return entries; });
+
+    build("huge.zip", [scale, mb]
+          { return std::vector<CorpusEntry>{{"huge/text.bin", textBytes(48 * mb * scale, 7), false},
+                                            {"huge/mixed.bin", randomBytes(16 * mb * scale, 8), false}}; });
+
+    build("text.zip", [scale, mb]
+          {
+        std::vector<CorpusEntry> entries;
+        for (size_t i = 0; i < 32; ++i)
+        {
+            entries.push_back({"text/" + std::to_string(i) + ".txt", textBytes(mb * scale, 100 + i), false});
+        }
+        return entries; });
+
+    build("random.zip", [scale, mb]
+          {
+        std::vector<CorpusEntry> entries;
+        for (size_t i = 0; i < 16; ++i)
+        {
+            entries.push_back({"random/" + std::to_string(i) + ".bin", randomBytes(mb * scale, 200 + i), false});
+        }
+        return entries; });
+
+    build("stored.zip", [scale, mb]
+          {
+        std::vector<CorpusEntry> entries;
+        for (size_t i = 0; i < 16; ++i)
+        {
+            entries.push_back({"stored/" + std::to_string(i) + ".bin", textBytes(mb * scale, 300 + i), true});
+        }
+        return entries; });
+}
+
+// Fastest of a few runs, the least disturbed by whatever else the machine is doing
+double bestOf(int runs, const std::function<void()> &work)
+{
+    double best = 1e300;
+
+    for (int i = 0; i < runs; ++i)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        work();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+
+    return best;
+}
+
+void report(std::string_view what, double value, std::string_view unit)
+{
+    std::cout << "  " << std::left << std::setw(40) << what << std::right << std::fixed << std::setprecision(1)
+              << std::setw(12) << value << " " << unit << "\n";
+}
+
+void benchArchive(const std::filesystem::path &path)
+{
+    std::cout << path.filename().string() << "\n";
+
+    const ArchiveFile file(path.string());
+    std::vector<uint8_t> scratch;
+
+    const double locate = bestOf(50, [&file, &scratch]
+                                 { scanForEOCD(file, scratch); });
+    report("EOCD locate", locate * 1e9, "ns");
+
+    size_t entries = 0;
+    const double parse = bestOf(5, [&file, &entries]
+                                { entries = readAllCentralDirsHeaders(file).size(); });
+    report("central directory", entries / parse / 1e6, "M entries/s");
+
+    const Archive archive(path.string());
+    uint64_t bytes = 0;
+
+    CallbackSink discard([&bytes](const uint8_t *, size_t size)
+                         { bytes += size; });
+
+    const double extract = bestOf(3, [&archive, &discard, &bytes]
+                                  {
+        bytes = 0;
+        for (uint32_t i = 0; i < archive.size(); ++i)
+        {
+            archive.extract(i, discard);
+        } });
+    report("extract (inflate + CRC-32)", bytes / extract / 1e6, "MB/s");
+    report("extract", archive.size() / extract, "entries/s");
+}
+
+void benchInflate(std::string_view what, const std::vector<uint8_t> &data)
+{
+    const std::vector<uint8_t> compressed = deflateBytes(data);
+    std::cout << "inflate " << what << " (" << data.size() / 1000000.0 << " MB, ratio "
+              << std::setprecision(2) << static_cast<double>(data.size()) / compressed.size() << ")\n";
+
+    CallbackSink discard([](const uint8_t *, size_t) {});
+
+    const double ours = bestOf(3, [&compressed, &discard]
+                               {
+        Inflater inflater(compressed.data(), compressed.size(), discard);
+        inflater.inflate(); });
+    report("zipreader", data.size() / ours / 1e6, "MB/s");
+
+#ifdef ZIPREADER_BENCH_ZLIB
+    std::vector<uint8_t> out(data.size());
+
+    const double reference = bestOf(3, [&compressed, &out]
+                                    {
+        z_stream stream{};
+        inflateInit2(&stream, -15);
+        stream.next_in = const_cast<Bytef *>(compressed.data());
+        stream.avail_in = static_cast<uInt>(compressed.size());
+        stream.next_out = out.data();
+        stream.avail_out = static_cast<uInt>(out.size());
+        inflate(&stream, Z_FINISH);
+        inflateEnd(&stream); });
+    report("zlib " ZLIB_VERSION, data.size() / reference / 1e6, "MB/s");
+#endif
+}
+
+void benchCrc(const std::vector<uint8_t> &data)
+{
+    std::cout << "crc32 (" << data.size() / 1000000.0 << " MB)\n";
+
+    uint32_t sum = 0;
+    const double ours = bestOf(5, [&data, &sum]
+                               { sum ^= Crc32::compute(0, data.data(), data.size()); });
+    report("zipreader", data.size() / ours / 1e6, "MB/s");
+
+#ifdef ZIPREADER_BENCH_ZLIB
+    const double reference = bestOf(5, [&data, &sum]
+                                    { sum ^= static_cast<uint32_t>(crc32(0, data.data(), static_cast<uInt>(data.size()))); });
+    report("zlib " ZLIB_VERSION, data.size() / reference / 1e6, "MB/s");
+#endif
+
+    // Keeps the loops from being optimised away
+    if (sum == 0x12345678)
+    {
+        std::cout << "";
+    }
+}
+
+// A service reading the same few entries of one archive, the way it would per request
+void benchEntryCache(const std::filesystem::path &path)
+{
+    std::cout << "entry cache (" << path.filename().string() << ", 3 hot entries)\n";
+
+    const Archive archive(path.string());
+    const std::string_view hot[] = {archive.entries().name(0), archive.entries().name(1), archive.entries().name(2)};
+    uint64_t bytes = 0;
+
+    const double uncached = bestOf(3, [&archive, &hot, &bytes]
+                                   {
+        for (const std::string_view name : hot)
+        {
+            bytes += archive.extract(name).size();
+        } });
+    report("extract every time", uncached / 3 * 1e6, "us/read");
+
+    EntryCache cache(size_t(64) << 20);
+    const double cached = bestOf(3, [&cache, &archive, &hot, &bytes]
+                                 {
+        for (int round = 0; round < 1000; ++round)
+        {
+            for (const std::string_view name : hot)
+            {
+                bytes += cache.get(archive, name)->size();
+            }
+        } });
+    report("through the cache", cached / 3000 * 1e6, "us/read");
+    report("hit rate", 100.0 * cache.hits() / (cache.hits() + cache.misses()), "%");
+
+    // Keeps the loops from being optimised away
+    if (bytes == 1)
+    {
+        std::cout << "";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const std::filesystem::path directory = argc > 1 ? argv[1] : "bench-corpus";
+    const size_t scale = argc > 2 ? std::stoul(argv[2]) : 1;
+
+    try
+    {
+        generateCorpus(directory, scale);
+
+        for (const char *name : {"tiny.zip", "huge.zip", "text.zip", "random.zip", "stored.zip"})
+        {
+            benchArchive(directory / name);
+        }
+
+        const size_t mb = size_t(1) << 20;
+        benchInflate("text", textBytes(32 * mb, 1));
+        benchInflate("random", randomBytes(32 * mb, 2));
+        benchCrc(randomBytes(64 * mb, 3));
+        benchEntryCache(directory / "text.zip");
+
+#ifndef ZIPREADER_BENCH_ZLIB
+        std::cout << "built without zlib, no reference numbers\n";
+#endif
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << "\n";
+        return -1;
+    }
+}
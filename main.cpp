@@ -1,474 +1,327 @@
 #include <iostream>
 #include <string>
-#include <fstream>
-#include <iomanip>
-#include <bitset>
 #include <string_view>
-#include <memory>
 #include <vector>
+#include <filesystem>
+#include <thread>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <optional>
 
-void printSpecialString(const std::string_view string);
-void readAllCentralDirsHeaders(std::ifstream &file);
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-struct CentralDirectoryFileHeader
-{
-    std::string sig, verMade, verMinim, gpf, compMethod, flt, fld, crc32, fName, eField, ifAttr, exFAttr, fileComment;
-    uint16_t flen, eFlen, fComlen, diskNumber;
-    uint32_t compSize, uncompSize, relativeOffsetOfHeader;
-
-    friend std::ostream &operator<<(std::ostream &os, const CentralDirectoryFileHeader &header)
-    {
+#include "Archive.hpp"
+#include "StreamReader.hpp"
+#include "Stats.hpp"
+#include "ZipWriter.hpp"
 
-        os << "Central Directory File Header\n";
-        os << "Signature:                   ";
-        printSpecialString(header.sig);
-        os << "\nVersion made by:             ";
-        printSpecialString(header.verMade);
-        os << "\nVersion minumum needed:      ";
-        printSpecialString(header.verMinim);
-        os << "\nGeneral Purpose Flag:        ";
-        printSpecialString(header.gpf);
-        os << "\nCompression Method:          ";
-        printSpecialString(header.compMethod);
-        os << "\nFile last modification time: ";
-        printSpecialString(header.flt);
-        os << "\nFile last modification date: ";
-        printSpecialString(header.fld);
-        os << "\nCRC-32:                      ";
-        printSpecialString(header.crc32);
-        os << "\nCompressed Size:             " << header.compSize << "\n";
-        os << "Uncompressed Size:           " << header.uncompSize << "\n";
-        os << "File Name Length:            " << header.flen << "\n";
-        os << "Extra Field Length:          " << header.eFlen << "\n";
-        os << "File Comment length:         " << header.fComlen << "\n";
-        os << "Disk Number:                 " << header.diskNumber << "\n";
-        os << "Internal File Attribute:     ";
-        printSpecialString(header.ifAttr);
-        os << "\nExternal File Attribute:     ";
-        printSpecialString(header.exFAttr);
-        os << "\nRelative Offset Of Header:   " << header.relativeOffsetOfHeader;
-        os << "\nFile name:                   ";
-        printSpecialString(header.fName);
-        os << "\nExtra field:                 ";
-        printSpecialString(header.eField);
-        os << "\nFile Comment:                ";
-        printSpecialString(header.fileComment);
-
-        return os;
-    }
+// --range offset length [--seek-index file]
+struct RangeRequest
+{
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    std::string seekIndexPath;
 };
 
-struct EOCD
-{
-    std::string sig, nrDisk, nrDiskWhereCDStarts, comment;
-    uint16_t nrCentralDirRecOnDisk, nrCentralDirTotal, comlen;
-    uint32_t sizeOfCD, offsetRelStart;
+int readFromStdin(const std::filesystem::path &outputDirectory, const std::vector<std::string> &entryNames);
+int openArchive(const std::string &archivePath, const std::filesystem::path &outputDirectory, const std::vector<std::string> &entryNames, size_t threads, const std::filesystem::path &indexCache, const std::optional<RangeRequest> &range, bool verifyStored);
+int readRange(const Archive &archive, const std::vector<std::string> &entryNames, const RangeRequest &range);
+void addToArchive(ZipWriter &writer, const std::filesystem::path &path);
+int createArchive(const std::string &archivePath, const std::vector<std::string> &inputs, size_t threads, int level);
 
-    friend std::ostream &operator<<(std::ostream &os, const EOCD &eocd)
+int readFromStdin(const std::filesystem::path &outputDirectory, const std::vector<std::string> &entryNames)
+{
+    if (!outputDirectory.empty())
     {
-        os << "End of central directory record\n";
-        os << "Signature:                               " << eocd.sig << "\n";
-        os << "Number of this disk:                     ";
-        printSpecialString(eocd.nrDisk);
-        os << "\nDisk where CD starts:                    ";
-        printSpecialString(eocd.nrDiskWhereCDStarts);
-        os << "\nNumber of CD on disk:                    " << eocd.nrCentralDirRecOnDisk << "\n";
-        os << "Total number of CD records:              " << eocd.nrCentralDirTotal << "\n";
-        os << "Size of CD:                              " << eocd.sizeOfCD << "\n";
-        os << "Offset of start of CD relative to start: " << eocd.offsetRelStart << "\n";
-        os << "Comment length:                          " << eocd.comlen << "\n";
-        os << "Comment:                                 " << eocd.comment << "\n";
-        return os;
+        extractStreamToDirectory(STDIN_FILENO, outputDirectory);
+        return 0;
     }
-};
 
-struct localFileHeader
-{
-    std::string sig, ver, gpf, compMethod, flt, fld, crc32, fName, eField;
-    uint16_t flen, eFlen;
-    uint32_t compSize, uncompSize;
+    CallbackSink toStdout([](const uint8_t *data, size_t size)
+                          { std::cout.write(reinterpret_cast<const char *>(data), size); });
 
-    std::vector<char> data;
+    StreamingReader reader(STDIN_FILENO);
+    bool allExtracted = true;
 
-    friend std::ostream &operator<<(std::ostream &os, const localFileHeader &ms)
+    while (reader.next())
     {
-        os << "Description for Local File Table\nLocal file header signature: ";
-        printSpecialString(ms.sig);
-        os << "\nVersion needed to extract:   ";
-        printSpecialString(ms.ver);
-        os << "\nGeneral Purpose Flag:        ";
-        printSpecialString(ms.gpf);
-        os << "\nCompresion Method:           ";
-        printSpecialString(ms.compMethod);
-        os << "\nFile Last Modification time: ";
-        printSpecialString(ms.flt);
-        os << "\nFile Last Modification date: ";
-        printSpecialString(ms.fld);
-        os << "\nCRC-32 of uncompressed data: ";
-        printSpecialString(ms.crc32);
-        os << "\nCompressed size:             " << ms.compSize;
-        os << "\nUncompressed size:           " << ms.uncompSize;
-        os << "\nFile Name Length:            " << ms.flen;
-        os << "\nExtra Field Length:          " << ms.eFlen;
-        os << "\nFile Name:                   ";
-        printSpecialString(ms.fName);
-        os << "\nExtra Field Name:            ";
-        printSpecialString(ms.eField);
-        os << "\nData Extracted:\n";
-
-        for (const char c : ms.data)
+        const std::string &name = reader.entry().name;
+
+        // Entries that were not asked for are skipped by the next call to next()
+        if (!entryNames.empty() && std::find(entryNames.begin(), entryNames.end(), name) == entryNames.end())
         {
-            os << c;
+            continue;
         }
 
-        return os;
+        allExtracted = reader.extract(toStdout) && allExtracted;
+
+        if (entryNames.empty())
+        {
+            std::cout << "\n===============================================\n";
+        }
     }
-};
 
-char *readBytes(std::ifstream &file, size_t numberBytes);
-void createLocalDescriptionTable(std::ifstream &file, const CentralDirectoryFileHeader& CD);
-EOCD scanForEOCD(std::ifstream &file);
+    return allExtracted ? 0 : -1;
+}
 
-[[nodiscard]] char *readBytes(std::ifstream &file, size_t numberBytes)
+int readRange(const Archive &archive, const std::vector<std::string> &entryNames, const RangeRequest &range)
 {
-    // I know I can use uniqe_ptr but it seems too powerfull for this
-    char *buff = new char[numberBytes];
-    file.read(buff, numberBytes);
-
-    if (file.gcount() != static_cast<long>(numberBytes))
+    if (entryNames.size() != 1)
     {
-        std::cerr << "Error reading byes, I wanted to read " << numberBytes << " but I only read " << file.gcount() << " bytes\n";
-        delete[] buff;
-
-        return nullptr;
+        throw std::runtime_error("--range needs exactly one entry name");
     }
 
-    return buff;
-}
-
-void createLocalDescriptionTable(std::ifstream &file, const CentralDirectoryFileHeader& CD)
-{
-    localFileHeader currentHeader;
+    const uint32_t i = archive.entries().find(entryNames.front());
+    if (i == CentralDirectoryIndex::NotFound)
+    {
+        throw std::runtime_error("No entry named " + entryNames.front());
+    }
 
-    size_t lengths[] = {4, 2, 2, 2, 2, 2, 4};
-    std::string *fields[] = {&currentHeader.sig, &currentHeader.ver, &currentHeader.gpf, &currentHeader.compMethod,
-                             &currentHeader.flt, &currentHeader.fld, &currentHeader.crc32};
-    unsigned char buff[4];
+    std::optional<SeekIndex> seekIndex;
 
-    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i)
+    // A saved index is only used for the entry it was built from, otherwise it is rebuilt
+    if (!range.seekIndexPath.empty() && archive.entries().entry(i).method == 8)
     {
-        file.read(reinterpret_cast<char *>(buff), lengths[i]);
+        seekIndex = SeekIndex::load(range.seekIndexPath);
 
-        if (fields[i] != nullptr)
+        if (!seekIndex || !seekIndex->matches(archive.entries().entry(i)))
         {
-            *fields[i] = std::string(reinterpret_cast<char *>(buff), lengths[i]);
+            seekIndex = archive.buildSeekIndex(i);
+            seekIndex->save(range.seekIndexPath);
         }
     }
 
-    file.read(reinterpret_cast<char *>(buff), 4);
-
-    uint32_t compressedSize =
-        static_cast<uint32_t>(buff[0]) |
-        (static_cast<uint32_t>(buff[1]) << 8) |
-        (static_cast<uint32_t>(buff[2]) << 16) |
-        (static_cast<uint32_t>(buff[3]) << 24);
+    CallbackSink toStdout([](const uint8_t *data, size_t size)
+                          { std::cout.write(reinterpret_cast<const char *>(data), size); });
 
-    currentHeader.compSize = compressedSize;
+    archive.readAt(i, range.offset, range.length, toStdout, seekIndex ? &*seekIndex : nullptr);
+    return 0;
+}
 
-    if(currentHeader.compSize == 0)
+int openArchive(const std::string &archivePath, const std::filesystem::path &outputDirectory, const std::vector<std::string> &entryNames, size_t threads, const std::filesystem::path &indexCache, const std::optional<RangeRequest> &range, bool verifyStored)
+{
+    if (archivePath == "-")
     {
-        currentHeader.compSize = CD.compSize;
+        return readFromStdin(outputDirectory, entryNames);
     }
 
-    file.read(reinterpret_cast<char *>(buff), 4);
+    const Archive archive = indexCache.empty() ? Archive(archivePath) : Archive(archivePath, IndexCache(indexCache));
 
-    uint32_t uncompressedSize =
-        static_cast<uint32_t>(buff[0]) |
-        (static_cast<uint32_t>(buff[1]) << 8) |
-        (static_cast<uint32_t>(buff[2]) << 16) |
-        (static_cast<uint32_t>(buff[3]) << 24);
-
-    currentHeader.uncompSize = uncompressedSize;
-
-    if(currentHeader.uncompSize == 0)
+    if (range)
     {
-        currentHeader.uncompSize = CD.uncompSize;
+        return readRange(archive, entryNames, *range);
     }
 
-    file.read(reinterpret_cast<char *>(buff), 2);
-    uint16_t flen =
-        static_cast<uint16_t>(buff[0]) |
-        (static_cast<uint16_t>(buff[1]) << 8);
-
-    currentHeader.flen = flen;
-
-    file.read(reinterpret_cast<char *>(buff), 2);
-    uint16_t eFlen =
-        static_cast<uint16_t>(buff[0]) |
-        (static_cast<uint16_t>(buff[1]) << 8);
-    currentHeader.eFlen = eFlen;
-
-    char *dynBuff = readBytes(file, currentHeader.flen);
-    currentHeader.fName = std::string(dynBuff, currentHeader.flen);
-    delete[] dynBuff;
-
-    dynBuff = readBytes(file, currentHeader.eFlen);
-    currentHeader.eField = std::string(dynBuff, currentHeader.eFlen);
-    delete[] dynBuff;
-
-    for (size_t i = 0; i < currentHeader.compSize; ++i)
+    if (!outputDirectory.empty())
     {
-        file.read(reinterpret_cast<char *>(buff), 1);
-
-        // We know we only read 1 byte so we can hack this
-        currentHeader.data.push_back(buff[0]);
+        archive.extractAll(outputDirectory, threads, verifyStored);
+        return 0;
     }
 
-    // std::cout << currentHeader;
+    CallbackSink toStdout([](const uint8_t *data, size_t size)
+                          { std::cout.write(reinterpret_cast<const char *>(data), size); });
 
-    for(const char c : currentHeader.data)
+    // Only the named entries when some were given, everything otherwise
+    if (!entryNames.empty())
     {
-        std::cout << c;
+        bool allExtracted = true;
+        for (const std::string &name : entryNames)
+        {
+            allExtracted = archive.extract(name, toStdout, threads) && allExtracted;
+        }
+        return allExtracted ? 0 : -1;
     }
-}
 
-void printSpecialString(const std::string_view string)
-{
-    for (size_t i = 0; i < string.size(); ++i)
+    for (uint32_t i = 0; i < archive.size(); ++i)
     {
-        if (std::isprint(static_cast<unsigned char>(string[i])))
-        {
-            std::cout << string[i];
-        }
-        else
-        {
-            // If non-printable, print its hex value in escape format
-            std::cout << "\\" << std::oct << static_cast<unsigned int>(static_cast<unsigned char>(string[i])) << std::dec;
-        }
+        archive.extract(i, toStdout, threads);
+
+        std::cout << "\n===============================================\n";
     }
+
+    return 0;
 }
 
-EOCD scanForEOCD(std::ifstream &file)
+void addToArchive(ZipWriter &writer, const std::filesystem::path &path)
 {
-    EOCD eocd;
-    constexpr unsigned char values[] = {0x50, 0x4b, 0x05, 0x06};
-    file.seekg(0);
+    struct stat info;
+    if (::stat(path.c_str(), &info) != 0)
+    {
+        throw std::runtime_error("Could not stat " + path.string() + ": " + std::strerror(errno));
+    }
 
-    unsigned char current_byte;
-    size_t sequence_index = 0;
+    // Stored names are relative and use forward slashes
+    std::string name = path.lexically_normal().relative_path().generic_string();
 
-    while (file.read(reinterpret_cast<char *>(&current_byte), 1))
+    if (S_ISDIR(info.st_mode))
     {
-        if (current_byte == values[sequence_index])
+        if (!name.empty() && name != ".")
         {
-            sequence_index++;
-
-            if (sequence_index == 4)
-            {
-                eocd.sig = "06054b50";
-
-                unsigned char buff[4];
-
-                file.read(reinterpret_cast<char *>(buff), 2);
-                eocd.nrDisk = std::string(reinterpret_cast<char *>(buff), 2);
-
-                file.read(reinterpret_cast<char *>(buff), 2);
-                eocd.nrDiskWhereCDStarts = std::string(reinterpret_cast<char *>(buff), 2);
-
-                file.read(reinterpret_cast<char *>(buff), 2);
-                uint16_t nrCentralDisk =
-                    static_cast<uint16_t>(buff[0]) |
-                    (static_cast<uint16_t>(buff[1]) << 8);
-
-                eocd.nrCentralDirRecOnDisk = nrCentralDisk;
-
-                file.read(reinterpret_cast<char *>(buff), 2);
+            writer.addDirectory(name, info.st_mtime);
+        }
 
-                uint16_t nrCentralDiskTot =
-                    static_cast<uint16_t>(buff[0]) |
-                    (static_cast<uint16_t>(buff[1]) << 8);
+        std::vector<std::filesystem::path> children;
+        for (const std::filesystem::directory_entry &child : std::filesystem::directory_iterator(path))
+        {
+            children.push_back(child.path());
+        }
+        std::sort(children.begin(), children.end());
 
-                eocd.nrCentralDirTotal = nrCentralDiskTot;
+        for (const std::filesystem::path &child : children)
+        {
+            addToArchive(writer, child);
+        }
+        return;
+    }
 
-                file.read(reinterpret_cast<char *>(buff), 4);
-                uint32_t sizeCD =
-                    static_cast<uint32_t>(buff[0]) |
-                    (static_cast<uint32_t>(buff[1]) << 8) |
-                    (static_cast<uint32_t>(buff[2]) << 16) |
-                    (static_cast<uint32_t>(buff[3]) << 24);
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("Could not open " + path.string());
+    }
 
-                eocd.sizeOfCD = sizeCD;
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    writer.add(std::move(name), std::move(data), info.st_mtime);
+}
 
-                file.read(reinterpret_cast<char *>(buff), 4);
-                uint32_t offSetOfStart =
-                    static_cast<uint32_t>(buff[0]) |
-                    (static_cast<uint32_t>(buff[1]) << 8) |
-                    (static_cast<uint32_t>(buff[2]) << 16) |
-                    (static_cast<uint32_t>(buff[3]) << 24);
+int createArchive(const std::string &archivePath, const std::vector<std::string> &inputs, size_t threads, int level)
+{
+    const int fd = ::open(archivePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Could not create " + archivePath + ": " + std::strerror(errno));
+    }
 
-                eocd.offsetRelStart = offSetOfStart;
+    try
+    {
+        FdSink sink(fd);
+        ZipWriter writer(sink, level, threads);
 
-                file.read(reinterpret_cast<char *>(buff), 2);
-                uint16_t commentLen =
-                    static_cast<uint16_t>(buff[0]) |
-                    (static_cast<uint16_t>(buff[1]) << 8);
+        for (const std::string &input : inputs)
+        {
+            addToArchive(writer, input);
+        }
 
-                eocd.comlen = commentLen;
+        writer.finish();
+    }
+    catch (...)
+    {
+        ::close(fd);
+        throw;
+    }
 
-                char *dymbuff = readBytes(file, commentLen);
+    ::close(fd);
+    return 0;
+}
 
-                eocd.comment = std::string(dymbuff, commentLen);
+int main(int argc, char **argv)
+{
+    // zipreader [-d directory [--verify-stored]] [-j threads] [--index-cache directory] [--stats] [archive [entry...]]
+    // zipreader [--range offset length [--seek-index file]] archive entry
+    // zipreader -c archive [-l level] [-j threads] path...
+    // Without -d the named entries, or every entry, are dumped to stdout in order,
+    // with it the whole archive is extracted in parallel.
+    // An archive named - is read from stdin front to back as it arrives.
+    // --index-cache keeps parsed central directories in the directory, later opens of an
+    // unchanged archive load them from there instead of parsing again.
+    // --range writes only those bytes of the entry, --seek-index keeps access points into it
+    // in the file (built on first use) so the read decodes from the closest one, not the start.
+    // Stored entries are copied into the directory by the kernel and not checked against
+    // their CRC unless --verify-stored.
+    // --stats prints per phase timings and counters as JSON on stderr afterwards.
+    std::string archivePath = "test.docx";
+    std::vector<std::string> entryNames;
+    bool havePath = false;
+    bool dumpStats = false;
+    bool verifyStored = false;
+    bool create = false;
+    int level = 6;
+    std::filesystem::path outputDirectory;
+    std::filesystem::path indexCache;
+    std::optional<RangeRequest> range;
+    std::string seekIndexPath;
+    size_t threads = std::thread::hardware_concurrency();
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view argument = argv[i];
 
-                delete[] dymbuff;
-                return eocd;
-            }
+        if (argument == "-d" && i + 1 < argc)
+        {
+            outputDirectory = argv[++i];
+        }
+        else if (argument == "-j" && i + 1 < argc)
+        {
+            threads = std::stoul(argv[++i]);
+        }
+        else if (argument == "-c")
+        {
+            create = true;
+        }
+        else if (argument == "-l" && i + 1 < argc)
+        {
+            level = std::stoi(argv[++i]);
+        }
+        else if (argument == "--index-cache" && i + 1 < argc)
+        {
+            indexCache = argv[++i];
+        }
+        else if (argument == "--range" && i + 2 < argc)
+        {
+            range = RangeRequest{std::stoull(argv[i + 1]), std::stoull(argv[i + 2]), {}};
+            i += 2;
+        }
+        else if (argument == "--seek-index" && i + 1 < argc)
+        {
+            seekIndexPath = argv[++i];
+        }
+        else if (argument == "--verify-stored")
+        {
+            verifyStored = true;
+        }
+        else if (argument == "--stats")
+        {
+            dumpStats = true;
+        }
+        else if (!havePath)
+        {
+            archivePath = argument;
+            havePath = true;
         }
         else
         {
-            sequence_index = 0;
+            entryNames.emplace_back(argument);
         }
     }
 
-    std::cerr << "Sequence not found, not a valid zip file\n";
-    exit(EXIT_FAILURE);
-}
-
-void readAllCentralDirsHeaders(std::ifstream &file)
-{
-    EOCD eocd = scanForEOCD(file);
-
-    // std::cout << eocd;
-    // std::cout << "\n===============================================\n";
-
-    file.seekg(eocd.offsetRelStart, std::ios::beg);
-    for (int i = 0; i < eocd.nrCentralDirTotal; ++i)
+    if (range)
     {
-        CentralDirectoryFileHeader currentHeader;
-
-        unsigned char buff[4];
-
-        file.read(reinterpret_cast<char *>(buff), 4);
-        currentHeader.sig = std::string(reinterpret_cast<char *>(buff), 4);
-
-        file.read(reinterpret_cast<char *>(buff), 2);
-        currentHeader.verMade = std::string(reinterpret_cast<char *>(buff), 2);
-
-        file.read(reinterpret_cast<char *>(buff), 2);
-        currentHeader.verMinim = std::string(reinterpret_cast<char *>(buff), 2);
-
-        file.read(reinterpret_cast<char *>(buff), 2);
-        currentHeader.gpf = std::string(reinterpret_cast<char *>(buff), 2);
-
-        file.read(reinterpret_cast<char *>(buff), 2);
-        currentHeader.compMethod = std::string(reinterpret_cast<char *>(buff), 2);
-
-        file.read(reinterpret_cast<char *>(buff), 2);
-        currentHeader.flt = std::string(reinterpret_cast<char *>(buff), 2);
-
-        file.read(reinterpret_cast<char *>(buff), 2);
-        currentHeader.fld = std::string(reinterpret_cast<char *>(buff), 2);
-
-        file.read(reinterpret_cast<char *>(buff), 4);
-        currentHeader.crc32 = std::string(reinterpret_cast<char *>(buff), 4);
-
-        file.read(reinterpret_cast<char *>(buff), 4);
-        uint32_t comSize =
-            static_cast<uint32_t>(buff[0]) |
-            (static_cast<uint32_t>(buff[1]) << 8) |
-            (static_cast<uint32_t>(buff[2]) << 16) |
-            (static_cast<uint32_t>(buff[3]) << 24);
-        currentHeader.compSize = comSize;
-
-        file.read(reinterpret_cast<char *>(buff), 4);
-        uint32_t uncompSize =
-            static_cast<uint32_t>(buff[0]) |
-            (static_cast<uint32_t>(buff[1]) << 8) |
-            (static_cast<uint32_t>(buff[2]) << 16) |
-            (static_cast<uint32_t>(buff[3]) << 24);
-        currentHeader.uncompSize = uncompSize;
-
-        file.read(reinterpret_cast<char *>(buff), 2);
-
-        uint16_t flen =
-            static_cast<uint16_t>(buff[0]) |
-            (static_cast<uint16_t>(buff[1]) << 8);
-        currentHeader.flen = flen;
-
-        file.read(reinterpret_cast<char *>(buff), 2);
-
-        uint16_t eflen =
-            static_cast<uint16_t>(buff[0]) |
-            (static_cast<uint16_t>(buff[1]) << 8);
-        currentHeader.eFlen = eflen;
-
-        file.read(reinterpret_cast<char *>(buff), 2);
-        uint16_t commentLen =
-            static_cast<uint16_t>(buff[0]) |
-            (static_cast<uint16_t>(buff[1]) << 8);
-
-        currentHeader.fComlen = commentLen;
-
-        file.read(reinterpret_cast<char *>(buff), 2);
-        uint16_t diskNum =
-            static_cast<uint16_t>(buff[0]) |
-            (static_cast<uint16_t>(buff[1]) << 8);
-        currentHeader.diskNumber = diskNum;
-
-        file.read(reinterpret_cast<char *>(buff), 2);
-        currentHeader.ifAttr = std::string(reinterpret_cast<char *>(buff), 2);
-
-        file.read(reinterpret_cast<char *>(buff), 4);
-        currentHeader.exFAttr = std::string(reinterpret_cast<char *>(buff), 4);
-
-        file.read(reinterpret_cast<char *>(buff), 4);
-        uint32_t relativeOffset =
-            static_cast<uint32_t>(buff[0]) |
-            (static_cast<uint32_t>(buff[1]) << 8) |
-            (static_cast<uint32_t>(buff[2]) << 16) |
-            (static_cast<uint32_t>(buff[3]) << 24);
-        currentHeader.relativeOffsetOfHeader = relativeOffset;
-
-        char *dymBuff = readBytes(file, currentHeader.flen);
-        currentHeader.fName = std::string(reinterpret_cast<char *>(dymBuff), currentHeader.flen);
-
-        delete[] dymBuff;
-
-        dymBuff = readBytes(file, currentHeader.eFlen);
-        currentHeader.eField = std::string(reinterpret_cast<char *>(dymBuff), currentHeader.eFlen);
-
-        delete[] dymBuff;
-
-        dymBuff = readBytes(file, currentHeader.fComlen);
-        currentHeader.fileComment = std::string(reinterpret_cast<char *>(dymBuff), currentHeader.fComlen);
-
-        delete[] dymBuff;
-
-        size_t currentIndex = file.tellg();
-        file.seekg(currentHeader.relativeOffsetOfHeader, std::ios::beg);
-        // std::cout << currentHeader;
-        // std::cout << "\n------------------------------------------------\n";
-
-        createLocalDescriptionTable(file, currentHeader);
-
-        file.seekg(currentIndex, std::ios::beg);
-
-        std::cout << "\n===============================================\n";
-    }   
-}
-
-int main()
-{
+        range->seekIndexPath = seekIndexPath;
+    }
 
-    std::ifstream file("test.docx", std::ios::binary);
+    int result = -1;
 
-    if (!file.is_open())
+    try
+    {
+        result = create ? createArchive(archivePath, entryNames, threads, level)
+                        : openArchive(archivePath, outputDirectory, entryNames, threads, indexCache, range, verifyStored);
+    }
+    catch (const std::exception &e)
     {
-        std::cerr << "Could not open file\n";
-        return -1;
+        std::cerr << e.what() << "\n";
     }
 
-    // createLocalDescriptionTable(file);
-    readAllCentralDirsHeaders(file);
+    if (dumpStats)
+    {
+#ifdef ZIPREADER_STATS
+        stats::writeJson(std::cerr, archivePath);
+#else
+        std::cerr << "--stats needs a build with -DZIPREADER_STATS\n";
+#endif
+    }
 
-    file.close();
-}
\ No newline at end of file
+    return result;
+}
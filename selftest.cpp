@@ -0,0 +1,447 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "AsyncArchive.hpp"
+#include "EntryCache.hpp"
+#include "ParallelInflate.hpp"
+#include "ZipWriter.hpp"
+
+// selftest [directory]
+// Writes sample archives into the directory (selftest-data by default) and checks the
+// parts of the library that none of the other programs run: the async reader against
+// Archive::extract, the entry cache, the parallel inflater, ZipWriter round trips up to
+// ZIP64 entry counts and range reads through a seek index.
+// Prints every failed check and exits non-zero if there was one.
+
+std::vector<uint8_t> sampleText(size_t size, uint32_t seed);
+std::vector<uint8_t> sampleNoise(size_t size, uint32_t seed);
+std::vector<uint8_t> zlibDeflate(const std::vector<uint8_t> &data, bool syncFlushOnly);
+void writeArchive(const std::filesystem::path &path, int level, size_t threads, const std::function<void(ZipWriter &)> &add);
+void writeSample(const std::filesystem::path &path, uint32_t seed);
+bool check(bool condition, std::string_view what);
+bool checkAsync(const std::filesystem::path &path, async::IoExecutor &executor, std::string_view executorName);
+bool checkEntryCache(const std::filesystem::path &path);
+bool checkParallelInflate(const std::filesystem::path &path);
+bool checkZipWriter(const std::filesystem::path &directory);
+bool checkZip64(const std::filesystem::path &directory);
+bool checkSeekIndex(const std::filesystem::path &path);
+
+// Words picked by an LCG, deflates to about a third
+std::vector<uint8_t> sampleText(size_t size, uint32_t seed)
+{
+    static constexpr std::string_view words[] = {
+        "<w:p>", "<w:r>", "<w:t>", "</w:t>", "</w:r>", "</w:p>", "zip", "entry", "deflate",
+        "window", "block", "chunk", "the", "of", "a", "\n", "  ", "0", "17", "4096"};
+
+    std::vector<uint8_t> bytes;
+    bytes.reserve(size + 16);
+    uint32_t state = seed;
+
+    while (bytes.size() < size)
+    {
+        state = state * 1664525u + 1013904223u;
+        const std::string_view word = words[(state >> 16) % std::size(words)];
+        bytes.insert(bytes.end(), word.begin(), word.end());
+    }
+    bytes.resize(size);
+    return bytes;
+}
+
+// Bytes that do not compress, ZipWriter has to store them
+std::vector<uint8_t> sampleNoise(size_t size, uint32_t seed)
+{
+    std::vector<uint8_t> bytes(size);
+    uint32_t state = seed;
+
+    for (uint8_t &byte : bytes)
+    {
+        state = state * 1664525u + 1013904223u;
+        byte = static_cast<uint8_t>(state >> 24);
+    }
+    return bytes;
+}
+
+// Raw deflate stream from zlib. syncFlushOnly cuts it into sync flushed pieces and never
+// finishes it, so the stream has no final block.
+std::vector<uint8_t> zlibDeflate(const std::vector<uint8_t> &data, bool syncFlushOnly)
+{
+    z_stream stream{};
+    if (deflateInit2(&stream, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        throw std::runtime_error("deflateInit2 failed");
+    }
+
+    // Every sync flush adds an empty stored block
+    const size_t piece = syncFlushOnly ? 65536 : std::max<size_t>(data.size(), 1);
+    std::vector<uint8_t> compressed(deflateBound(&stream, data.size()) + (data.size() / piece + 1) * 8);
+
+    stream.next_out = compressed.data();
+    stream.avail_out = static_cast<uInt>(compressed.size());
+
+    size_t offset = 0;
+    do
+    {
+        const size_t length = std::min(piece, data.size() - offset);
+        const bool last = offset + length == data.size();
+
+        stream.next_in = const_cast<Bytef *>(data.data() + offset);
+        stream.avail_in = static_cast<uInt>(length);
+
+        const int flush = syncFlushOnly ? Z_SYNC_FLUSH : last ? Z_FINISH : Z_NO_FLUSH;
+        if (deflate(&stream, flush) != (flush == Z_FINISH ? Z_STREAM_END : Z_OK) || stream.avail_in)
+        {
+            deflateEnd(&stream);
+            throw std::runtime_error("zlib could not deflate the sample");
+        }
+        offset += length;
+    } while (offset < data.size());
+
+    compressed.resize(stream.total_out);
+    deflateEnd(&stream);
+    return compressed;
+}
+
+void writeArchive(const std::filesystem::path &path, int level, size_t threads, const std::function<void(ZipWriter &)> &add)
+{
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Could not create " + path.string() + ": " + std::strerror(errno));
+    }
+
+    try
+    {
+        FdSink sink(fd);
+        ZipWriter writer(sink, level, threads);
+        add(writer);
+        writer.finish();
+    }
+    catch (...)
+    {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+}
+
+// Small and empty entries, a directory and one deflated entry much larger than
+// AsyncArchive::ChunkSize, so chunked reads have to resume inside its stream
+void writeSample(const std::filesystem::path &path, uint32_t seed)
+{
+    writeArchive(path, 6, std::thread::hardware_concurrency(), [seed](ZipWriter &writer)
+                 {
+        writer.addDirectory("word/");
+        writer.add("[Content_Types].xml", sampleText(700, seed));
+        writer.add("word/document.xml", sampleText(6 * 1024 * 1024, seed + 1));
+        writer.add("word/styles.xml", sampleText(40000, seed + 2));
+        writer.add("word/settings.xml", sampleText(1000, seed + 3));
+        writer.add("empty.txt", {}); });
+}
+
+bool check(bool condition, std::string_view what)
+{
+    if (!condition)
+    {
+        std::cout << "FAIL " << what << "\n";
+    }
+    return condition;
+}
+
+// Every entry read through AsyncArchive at once, all of them in flight together
+bool checkAsync(const std::filesystem::path &path, async::IoExecutor &executor, std::string_view executorName)
+{
+    const std::string prefix = "async (" + std::string(executorName) + "): ";
+    AsyncArchive archive = async::blockOn(executor, AsyncArchive::open(executor, path.string()));
+    const Archive reference(path.string());
+
+    bool passed = check(archive.size() == reference.size(), prefix + "entry count");
+
+    // Sinks have to stay put while their tasks run
+    std::deque<BufferSink> sinks;
+    std::vector<async::Task<bool>> reads;
+
+    for (uint32_t i = 0; i < archive.size(); ++i)
+    {
+        reads.push_back(archive.readEntry(archive.entries().name(i), sinks.emplace_back()));
+        reads.back().start();
+    }
+
+    while (executor.inFlight())
+    {
+        executor.poll(true);
+    }
+
+    for (uint32_t i = 0; i < archive.size(); ++i)
+    {
+        const std::string name(archive.entries().name(i));
+
+        if (check(reads[i].done() && reads[i].result(), prefix + "read " + name))
+        {
+            passed = check(std::ranges::equal(sinks[i].bytes(), reference.extract(name)), prefix + "content of " + name) && passed;
+        }
+        else
+        {
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+// Hit and miss counts, LRU eviction under the byte budget and invalidation once the
+// archive's modification time changes
+bool checkEntryCache(const std::filesystem::path &path)
+{
+    const std::string types = "[Content_Types].xml", styles = "word/styles.xml", settings = "word/settings.xml";
+    bool passed = true;
+
+    {
+        const Archive archive(path.string());
+        EntryCache cache(archive.find(types)->uncompressedSize + archive.find(styles)->uncompressedSize);
+
+        const EntryCache::Buffer first = cache.get(archive, types);
+        passed = check(*first == archive.extract(types), "cache: content of a miss") && passed;
+        passed = check(cache.get(path.string(), types) == first, "cache: a hit hands out the cached buffer") && passed;
+        cache.get(archive, types);
+        passed = check(cache.hits() == 2 && cache.misses() == 1, "cache: three gets of one entry are two hits and one miss") && passed;
+
+        // Fills the budget, then types is used again so styles is the one evicted for settings
+        cache.get(archive, styles);
+        cache.get(archive, types);
+        cache.get(archive, settings);
+        passed = check(cache.entries() == 2 && cache.bytes() <= archive.find(types)->uncompressedSize + archive.find(styles)->uncompressedSize,
+                       "cache: stays within its budget") &&
+                 passed;
+
+        cache.get(archive, types);
+        cache.get(archive, settings);
+        passed = check(cache.hits() == 5 && cache.misses() == 3, "cache: least recently used entry evicted first") && passed;
+        // Coming back it needs the room of both others
+        cache.get(archive, styles);
+        passed = check(cache.misses() == 4 && cache.entries() == 1, "cache: evicted entry is a miss") && passed;
+
+        cache.get(archive, "word/document.xml");
+        passed = check(cache.entries() == 1 && cache.misses() == 5, "cache: entry over the budget is not kept") && passed;
+    }
+
+    // The same archive rewritten: only the modification time differs
+    const std::filesystem::path changed = path.parent_path() / "changed.zip";
+    std::filesystem::copy_file(path, changed, std::filesystem::copy_options::overwrite_existing);
+
+    EntryCache cache(size_t(1) << 20);
+    const EntryCache::Buffer before = cache.get(changed.string(), types);
+    cache.get(changed.string(), types);
+
+    std::filesystem::last_write_time(changed, std::filesystem::last_write_time(changed) + std::chrono::seconds(1));
+
+    const EntryCache::Buffer after = cache.get(changed.string(), types);
+    passed = check(cache.hits() == 1 && cache.misses() == 2, "cache: modification time change is a miss") && passed;
+    passed = check(after != before && *after == *before, "cache: changed archive decoded again") && passed;
+
+    const Archive reopened(changed.string());
+    cache.get(reopened, types);
+    passed = check(cache.hits() == 2 && cache.entries() == 1, "cache: stale version replaced, not kept beside it") && passed;
+
+    return passed;
+}
+
+// zlib's stream and ZipWriter's own, cut into chunks from a few KiB up so nearly every
+// chunk starts on a guessed block boundary and resolves window markers from its
+// predecessor. A stream without a final block has to fail, not hang.
+bool checkParallelInflate(const std::filesystem::path &path)
+{
+    const Archive archive(path.string());
+    const std::string name = "word/document.xml";
+    const std::vector<uint8_t> text = archive.extract(name);
+    const EntryInfo &entry = archive.entries().entry(archive.entries().find(name));
+
+    std::vector<uint8_t> scratch;
+    const std::span<const uint8_t> written = archive.file().read(entryDataOffset(archive.file(), entry), static_cast<size_t>(entry.compressedSize), scratch);
+    const std::vector<uint8_t> fromWriter(written.begin(), written.end());
+
+    const std::pair<std::string_view, std::vector<uint8_t>> streams[] = {{"zlib", zlibDeflate(text, false)}, {"ZipWriter", std::move(fromWriter)}};
+    const uint32_t crc = Crc32::compute(0, text.data(), text.size());
+    bool passed = true;
+
+    for (const auto &[source, stream] : streams)
+    {
+        for (const size_t chunkSize : {size_t(5000), size_t(64 * 1024), size_t(1) << 20, stream.size()})
+        {
+            const std::string what = "parallel inflate: " + std::string(source) + " stream in chunks of " + std::to_string(chunkSize);
+            BufferSink sink;
+            sink.begin(text.size());
+
+            ParallelInflater inflater(stream, sink, 3, chunkSize);
+            inflater.inflate();
+            passed = check(std::ranges::equal(sink.bytes(), text) && inflater.crc32() == crc, what) && passed;
+        }
+    }
+
+    const std::vector<uint8_t> unfinished = zlibDeflate(text, true);
+    for (const size_t chunkSize : {size_t(5000), size_t(1) << 20})
+    {
+        bool failed = false;
+
+        try
+        {
+            CallbackSink discard([](const uint8_t *, size_t) {});
+            ParallelInflater inflater(unfinished, discard, 3, chunkSize);
+            inflater.inflate();
+        }
+        catch (const std::exception &)
+        {
+            failed = true;
+        }
+        passed = check(failed, "parallel inflate: stream without a final block in chunks of " + std::to_string(chunkSize)) && passed;
+    }
+
+    return passed;
+}
+
+// Every level on one and several threads: entries spanning several compressed pieces, one
+// that does not shrink and is stored, a directory and an empty file, all read back as written
+bool checkZipWriter(const std::filesystem::path &directory)
+{
+    const std::vector<uint8_t> text = sampleText(3 * flate::CompressChunkSize + 1234, 7), noise = sampleNoise(200000, 8), small = sampleText(100, 9);
+    const std::filesystem::path path = directory / "written.zip";
+    bool passed = true;
+
+    for (const int level : {0, 1, 6, 9})
+    {
+        for (const size_t threads : {size_t(1), size_t(3)})
+        {
+            const std::string prefix = "ZipWriter (level " + std::to_string(level) + ", " + std::to_string(threads) + " threads): ";
+
+            writeArchive(path, level, threads, [&](ZipWriter &writer)
+                         {
+                writer.add("text.txt", text);
+                writer.add("noise.bin", noise);
+                writer.addDirectory("dir");
+                writer.add("dir/small.txt", small);
+                writer.add("dir/empty.txt", {}); });
+
+            const Archive archive(path.string());
+            passed = check(archive.size() == 5, prefix + "entry count") && passed;
+            passed = check(archive.find("dir/") && archive.find("dir/")->uncompressedSize == 0, prefix + "directory") && passed;
+            passed = check(archive.extract("text.txt") == text && archive.find("text.txt")->method == (level ? 8 : 0), prefix + "multi-piece entry") && passed;
+            passed = check(archive.extract("noise.bin") == noise && archive.find("noise.bin")->method == 0, prefix + "incompressible entry stored") && passed;
+            passed = check(archive.extract("dir/small.txt") == small, prefix + "small entry") && passed;
+            passed = check(archive.extract("dir/empty.txt").empty(), prefix + "empty entry") && passed;
+        }
+    }
+    return passed;
+}
+
+// More entries than the end of central directory record can count, so ZipWriter has to
+// add the ZIP64 records and the reader has to take the count from them. Stored, a deflater
+// for each of them would take most of the run.
+bool checkZip64(const std::filesystem::path &directory)
+{
+    const uint32_t count = 0xFFFF + 100;
+    const std::filesystem::path path = directory / "zip64.zip";
+
+    writeArchive(path, 0, std::thread::hardware_concurrency(), [](ZipWriter &writer)
+                 {
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            const std::string content = std::to_string(i);
+            writer.add("entries/" + content, std::vector<uint8_t>(content.begin(), content.end()));
+        } });
+
+    const Archive archive(path.string());
+    bool passed = check(archive.size() == count, "zip64: entry count");
+
+    for (const uint32_t i : {0u, 0xFFFEu, 0xFFFFu, count - 1})
+    {
+        const std::string content = std::to_string(i);
+        const std::vector<uint8_t> extracted = archive.extract("entries/" + content);
+        passed = check(std::ranges::equal(extracted, content), "zip64: content of entry " + content) && passed;
+    }
+    return passed;
+}
+
+// Ranges read without an index, with one and with one saved and loaded again all have to
+// match the same slice of the whole entry: across access points, cut at the end, past it
+bool checkSeekIndex(const std::filesystem::path &path)
+{
+    const Archive archive(path.string());
+    const std::string name = "word/document.xml";
+    const uint32_t i = archive.entries().find(name);
+    const std::vector<uint8_t> whole = archive.extract(name);
+
+    const SeekIndex index = archive.buildSeekIndex(i, 256 * 1024);
+    bool passed = check(index.points().size() >= whole.size() / (256 * 1024) - 1, "seek index: access point spacing");
+
+    const std::string saved = (path.parent_path() / "document.index").string();
+    index.save(saved);
+    const std::optional<SeekIndex> loaded = SeekIndex::load(saved);
+    passed = check(loaded && loaded->matches(archive.entries().entry(i)) && loaded->points().size() == index.points().size(), "seek index: saved and loaded") && passed;
+
+    const uint64_t pointOutput = index.points().size() > 3 ? index.points()[3].output : 0;
+    const std::pair<uint64_t, uint64_t> ranges[] = {
+        {0, 100}, {pointOutput, 10}, {pointOutput - 10, 20}, {1234567, 300000}, {whole.size() - 50, 100}, {whole.size() + 10, 5}};
+
+    for (const auto &[offset, length] : ranges)
+    {
+        const size_t from = static_cast<size_t>(std::min<uint64_t>(offset, whole.size()));
+        const size_t to = static_cast<size_t>(std::min<uint64_t>(offset + length, whole.size()));
+        const std::span<const uint8_t> expected(whole.data() + from, to - from);
+        const std::string what = "seek index: range " + std::to_string(offset) + " + " + std::to_string(length);
+
+        passed = check(std::ranges::equal(archive.readAt(i, offset, length), expected), what + " without index") && passed;
+        passed = check(std::ranges::equal(archive.readAt(i, offset, length, &index), expected), what) && passed;
+        if (loaded)
+        {
+            passed = check(std::ranges::equal(archive.readAt(i, offset, length, &*loaded), expected), what + " with loaded index") && passed;
+        }
+    }
+    return passed;
+}
+
+int main(int argc, char **argv)
+{
+    const std::filesystem::path directory = argc > 1 ? argv[1] : "selftest-data";
+    bool passed = true;
+
+    try
+    {
+        std::filesystem::create_directories(directory);
+        const std::filesystem::path sample = directory / "sample.zip";
+        writeSample(sample, 1);
+
+        async::ThreadPoolExecutor pool(2);
+        passed = checkAsync(sample, pool, "thread pool") && passed;
+
+        const std::unique_ptr<async::IoExecutor> executor = async::makeIoExecutor();
+        passed = checkAsync(sample, *executor, "default") && passed;
+
+        passed = checkEntryCache(sample) && passed;
+        passed = checkParallelInflate(sample) && passed;
+        passed = checkZipWriter(directory) && passed;
+        passed = checkZip64(directory) && passed;
+        passed = checkSeekIndex(sample) && passed;
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "FAIL " << e.what() << "\n";
+        passed = false;
+    }
+
+    std::cout << (passed ? "all checks passed\n" : "some checks failed\n");
+    return passed ? 0 : 1;
+}
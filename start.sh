@@ -10,4 +10,14 @@ g++ deflate.cpp -o deflate -std=c++23 -Wall -Wextra -Wformat-nonliteral -Wcast-a
 
 # g++ BitReader.cpp -o BitReader -std=c++23 -Wall -Wextra -Wformat-nonliteral -Wcast-align -Wpointer-arith -Wmissing-declarations -Winline -Wundef -Wcast-qual -Wshadow -Wwrite-strings -Wno-unused-parameter -Wfloat-equal -pedantic -fsanitize=address -fsanitize=leak
 
-# ./BitReader
\ No newline at end of file
+# ./BitReader
+# Benchmarks want optimisation and no sanitizers, -lz adds the zlib reference numbers
+# g++ bench.cpp -o bench -O2 -std=c++23 -Wall -Wextra -Wformat-nonliteral -Wcast-align -Wpointer-arith -Wmissing-declarations -Wundef -Wcast-qual -Wshadow -Wwrite-strings -Wno-unused-parameter -Wfloat-equal -pedantic -lz
+
+# ./bench bench-corpus
+
+# Checks the async reader, the entry cache, the parallel inflater, ZipWriter and range
+# reads on generated sample archives, -lz provides a second deflate stream to decode
+# g++ selftest.cpp -o selftest -std=c++23 -Wall -Wextra -Wformat-nonliteral -Wcast-align -Wpointer-arith -Wmissing-declarations -Winline -Wundef -Wcast-qual -Wshadow -Wwrite-strings -Wno-unused-parameter -Wfloat-equal -pedantic -fsanitize=address -fsanitize=leak -lz
+
+# ./selftest